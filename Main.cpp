@@ -12,10 +12,19 @@
 #include <sstream>
 #include <vector>
 #include <unordered_map>
+#include <map>
+#include <tuple>
 #include <chrono>
 #include <thread>
+#include <functional>
 #include <sqlite3.h>
 #include "csv_parser.hpp"
+#include "string_intern.hpp"
+#include "job_cache.hpp"
+#include "commit_scheduler.hpp"
+#include "log_reader.hpp"
+#include "job_filter.hpp"
+#include "schema.hpp"
 
 /*
  *
@@ -53,83 +62,32 @@
  * 3. check timestamp of block and ignore if need be
  * 4. continue to the end of the file, gathering any new data
  * 5. finally, insert new data into the db
+ *
+ * How far into the log we got is stored in the ingest_state table
+ * (file segment, offset and a fingerprint of the bytes before the
+ * offset), in the same transaction as the rows
+ * read up to there. The next run, including one after a crash,
+ * starts reading right where the last commit left off.
  * 
  * */
 
-// filepath to log file
+// filepath to log file, or a comma separated list of
+// files (rotated archives first) to be read as one log
 std::string LOGFILE;
 // name of printer
 std::string PRINTER;
+// memory cap on the parsed blocks held at once, in bytes
+size_t CHUNK_BYTES = 4 << 20;
 
-// define value field labels
-const std::string labels[] = {
-  "JobID: ",                    // 0
-  "Job Name: ",                 // 1
-  "Print Function: ",           // 2
-  "Copies Printed: ",           // 3
-  "Total Copies: ",             // 4
-  "Completed: ",                // 5
-  "Canceled: ",                 // 6
-  "DoubleSided: ",              // 7
-  "Time Started: ",             // 8
-  "Time Duration: ",            // 9
-  "Time Units: ",               // 10
-  "Image Width: ",              // 11
-  "Image Length: ",             // 12
-  "Media Length: ",             // 13
-  "Prints Per Job: ",           // 14
-  "Media Name: ",               // 15
-  "Media IntegrationId: ",      // 16
-  "Type: ",                     // 17
-  "Media Width: ",              // 18
-  "Media Height: ",             // 19
-  "Media Grade: ",              // 20
-  "Media Offset: ",             // 21
-  "Media Units: ",              // 22
-  "Sqft Media Printed: ",       // 23
-  "Ink Consumption: ",          // 24
-  "Ink Units: "};               // 25
-
-// 'clean' versions of the above labels
-// for use as keys and attribute names
-const std::string keys[] = {
-  "job_id",                      // 0
-  "job_name",                    // 1
-  "print_function",              // 2
-  "copies_printed",              // 3
-  "total_copies",                // 4
-  "completed",                   // 5
-  "cancelled",                   // 6
-  "doublesided",                 // 7
-  "time_started",                // 8
-  "time_duration",               // 9
-  "time_units",                  // 10
-  "image_width",                 // 11
-  "image_length",                // 12
-  "media_length",                // 13
-  "prints_per_job",              // 14
-  "media_name",                  // 15
-  "media_integrationid",         // 16
-  "type",                        // 17
-  "media_width",                 // 18
-  "media_height",                // 19
-  "media_grade",                 // 20
-  "media_offset",                // 21
-  "media_units",                 // 22
-  "sqft_media_printed",          // 23
-
- // ink keys
-
-  "c_ink",
-  "m_ink",
-  "y_ink",
-  "k_ink",
-  "lc_ink",
-  "lm_ink",
-  "ly_ink",
-  "lk_ink",
-  "w_ink"};
+// printer model the log comes from, see schema.hpp
+std::string MODEL = "vutek_8c";
 
+// receives parsed records a chunk at a time. more is true when the
+// chunk was cut short by CHUNK_BYTES and the log has more to give,
+// upto is where the log has been dealt with once the chunk is in.
+// returns false if the chunk could not be taken and reading should stop
+template <class Model>
+using record_sink = std::function<bool(std::vector<job_record<Model>>& vals, bool more, const log_position& upto)>;
 
 //#####################
 // GET LATEST TIME
@@ -137,91 +95,112 @@ const std::string keys[] = {
 
 // performs action #1 from above list
 // returns latest timestamp in string format 
+template <class Model>
 std::string get_latest_time() {
 
 /* PART 1: DEFINE VARS AND OPEN DB */
 
-  // define database variables
-  sqlite3* db;
-  char* err_msg = 0;
-  int rc = sqlite3_open("sdc_printer.db", &db);
-  std::string sql;
-
-  // test if opening the db was successful
-  if (rc) {
-    std::cerr << "SQLITE3: cannot open database <" << sqlite3_errmsg(db) << '>' << std::endl;
+  // define database variables. this runs every poll, so it goes
+  // through the writer's connection rather than opening a new one
+  if (!open_writer()) {
     // cut the program short
     return "EXIT";
-  } else {
-    std::cout << "SQLITE3: opened database successfully" << std::endl;
   }
+  sqlite3* db = WRITER_DB;
+  char* err_msg = 0;
+  int rc;
+  std::string sql;
+
+  /* PART 2: Create the model's tables if need be */
 
-  /* PART 2: Create print_jobs table if need be */
-
-  // create print_jobs table if it does not exist
-  // here we define the sql statement to do so
-  // we will be storing everything as text because
-  // it is coming to us as text, and we do not need
-  // to do any operations on the values.
-  sql = "CREATE TABLE IF NOT EXISTS print_jobs(" \
-        "id                      integer NOT NULL PRIMARY KEY AUTOINCREMENT," \
-        "printer_name            text    NOT NULL," \
-        "job_id                  text    NOT NULL," \
-        "job_name                text    NOT NULL," \
-        "print_function          text    NOT NULL," \
-        "copies_printed          text    NOT NULL," \
-        "total_copies            text    NOT NULL," \
-        "completed               text    NOT NULL," \
-        "canceled                text    NOT NULL," \
-        "doublesided             text    NOT NULL," \
-        "time_started            text    NOT NULL," \
-        "time_duration           text    NOT NULL," \
-        "time_units              text    NOT NULL," \
-        "image_width             text    NOT NULL," \
-        "image_length            text    NOT NULL," \
-        "media_length            text    NOT NULL," \
-        "prints_per_job          text    NOT NULL," \
-        "media_name              text    NOT NULL," \
-        "media_integrationid     text    NOT NULL," \
+  // the values that repeat on every row (printer, media) are
+  // normalized out into small lookup tables keyed by integer
+  // ids, the model's table then only stores the ids.
+  sql = "CREATE TABLE IF NOT EXISTS printer(" \
+        "id                      integer NOT NULL PRIMARY KEY," \
+        "name                    text    NOT NULL UNIQUE);" \
+        "CREATE TABLE IF NOT EXISTS media(" \
+        "id                      integer NOT NULL PRIMARY KEY," \
+        "name                    text    NOT NULL," \
         "type                    text    NOT NULL," \
-        "media_width             text    NOT NULL," \
-        "media_height            text    NOT NULL," \
-        "media_grade             text    NOT NULL," \
-        "media_offset            text    NOT NULL," \
-        "media_units             text    NOT NULL," \
-        "sqft_media_printed      text    NOT NULL," \
-        "c_ink                   text    NOT NULL," \
-        "m_ink                   text    NOT NULL," \
-        "y_ink                   text    NOT NULL," \
-        "k_ink                   text    NOT NULL," \
-        "lc_ink                  text    NOT NULL," \
-        "lm_ink                  text    NOT NULL," \
-        "ly_ink                  text    NOT NULL," \
-        "lk_ink                  text    NOT NULL," \
-        "w_ink                   text    NOT NULL);";
+        "units                   text    NOT NULL," \
+        "UNIQUE(name, type, units));" \
+        "CREATE TABLE IF NOT EXISTS ingest_state(" \
+        "printer_id              integer NOT NULL PRIMARY KEY REFERENCES printer(id)," \
+        "segment                 text    NOT NULL," \
+        "log_offset              integer NOT NULL," \
+        "fingerprint             text    NOT NULL DEFAULT '');";
+  sql += create_table_sql<Model>();
 
   // execute the statement
   rc = sqlite3_exec(db, sql.c_str(), NULL, 0, &err_msg);
   // test if execution of statement was successful
   if (rc) {
-    // either the table could not be created or something else bad happened
-    std::cerr << "SQLITE3: cannot create table 'print_jobs' <" << sqlite3_errmsg(db) << '>' << std::endl;
+    // either the tables could not be created or something else bad happened
+    std::cerr << "SQLITE3: cannot create table '" << Model::table << "' <" << sqlite3_errmsg(db) << '>' << std::endl;
     sqlite3_free(err_msg);
     // cut the program short
     return "EXIT";
   } else {
     // everything is good and we can continue 
-    std::cout << "SQLITE3: table 'print_jobs' created successfully (or already exists)" << std::endl; 
+    std::cout << "SQLITE3: table '" << Model::table << "' created successfully (or already exists)" << std::endl; 
   }
 
-  /* PART 3: Check row count int print_jobs table */
+  // ingest_state tables from before the fingerprint get it added,
+  // their checkpoints have none and are read again from the start
+  if (sqlite3_exec(db, "SELECT fingerprint FROM ingest_state LIMIT 0;", NULL, 0, NULL)) {
+    rc = sqlite3_exec(db, "ALTER TABLE ingest_state ADD COLUMN fingerprint text NOT NULL DEFAULT '';", NULL, 0, &err_msg);
+    if (rc) {
+      std::cerr << "SQLITE3: cannot add fingerprint to ingest_state <" << sqlite3_errmsg(db) << '>' << std::endl;
+      sqlite3_free(err_msg);
+      // cut the program short
+      return "EXIT";
+    }
+  }
+
+  // older databases have a flat table with the printer and media
+  // stored as text on every row, under the name the view has now.
+  // if we find one we move its rows over to the model's table and
+  // drop it so the view below can take its name.
+  std::string old_type;
+  sql = std::string("SELECT type FROM sqlite_master WHERE name = '") + Model::view + "';";
+  auto type_callback = [](void* data, int argc, char* argv[], char* col_names[]) -> int {
+    std::string* old_type = static_cast<std::string*>(data);
+    *old_type = argv[0];
+    return 0;
+  };
+  rc = sqlite3_exec(db, sql.c_str(), type_callback, static_cast<void*>(&old_type), &err_msg);
+  if (!rc && old_type == "table") {
+    sql = migrate_sql<Model>();
+    rc = sqlite3_exec(db, sql.c_str(), NULL, 0, &err_msg);
+  }
+  if (rc) {
+    std::cerr << "SQLITE3: cannot migrate table '" << Model::view << "' <" << sqlite3_errmsg(db) << '>' << std::endl;
+    sqlite3_free(err_msg);
+    sqlite3_exec(db, "ROLLBACK;", NULL, 0, NULL);
+    // cut the program short
+    return "EXIT";
+  }
+
+  // the view is kept around with the old flat layout
+  // so existing reports and queries keep working unchanged
+  sql = create_view_sql<Model>();
+  rc = sqlite3_exec(db, sql.c_str(), NULL, 0, &err_msg);
+  if (rc) {
+    std::cerr << "SQLITE3: cannot create view '" << Model::view << "' <" << sqlite3_errmsg(db) << '>' << std::endl;
+    sqlite3_free(err_msg);
+    // cut the program short
+    return "EXIT";
+  }
+
+  /* PART 3: Check row count int the model's table */
 
   // before we query for the most recent timestamp, we need to
   // make sure that there are at least one rows in the table
   // we will store the row count in this variable
   int row_count = 0;
   // define the row count query
-  sql = "SELECT COUNT(*) FROM print_jobs;";
+  sql = std::string("SELECT COUNT(*) FROM ") + Model::table + ";";
   // define our row count callback as a lambda for easy visibility
   auto rc_callback = [](void* data, int argc, char* argv[], char* col_names[]) -> int { 
     int* row_count = static_cast<int*>(data);
@@ -245,7 +224,7 @@ std::string get_latest_time() {
       /* PART 4: Select and return the lastest timestamp */
       
       // we want to query for the highest 'time started' attribute value
-      sql = "SELECT MAX(time_started) FROM print_jobs;";
+      sql = std::string("SELECT MAX(time_started) FROM ") + Model::table + ";";
       // we will store the result of the query in this variable
       std::vector<std::string> results; 
       // define our time stamp callback as a lumbda for easy visibility
@@ -280,169 +259,322 @@ std::string get_latest_time() {
   } 
 }
 
+//#####################
+// GET CHECKPOINT
+//#####################
+
+// returns where in the log the last commit for PRINTER left off,
+// or the beginning of the log if nothing has been committed yet
+log_position get_checkpoint() {
+  log_position from;
+  if (!open_writer()) {
+    return from;
+  }
+  sql_statement checkpoint = {"SELECT s.segment, s.log_offset, s.fingerprint FROM ingest_state s " \
+        "JOIN printer p ON p.id = s.printer_id WHERE p.name = ?;", {PRINTER}};
+  // define our checkpoint callback as a lambda for easy visibility
+  auto cp_row = [&from](sqlite3_stmt* row) {
+    from.segment = column_text(row, 0);
+    from.offset = sqlite3_column_int64(row, 1);
+    from.fingerprint = column_text(row, 2);
+  };
+  if (!run_statement(WRITER_DB, checkpoint, cp_row)) {
+    std::cerr << "SQLITE3: cannot execute checkpoint query <" << sqlite3_errmsg(WRITER_DB) << '>' << std::endl;
+    return log_position();
+  }
+  if (from.segment.empty()) {
+    std::cout << "get_checkpoint(): no checkpoint for <" << PRINTER << ">, reading the whole log" << std::endl;
+  } else {
+    std::cout << "get_checkpoint(): resuming from segment <" << from.segment << "> offset <" << from.offset << '>' << std::endl;
+  }
+  return from;
+}
+
+// returns the statement that records position p for the printer
+sql_statement checkpoint_statement(int printer_id, const log_position& p) {
+  return {"INSERT OR REPLACE INTO ingest_state (printer_id, segment, log_offset, fingerprint) VALUES (?, ?, ?, ?);",
+          {std::to_string(printer_id), p.segment, std::to_string(p.offset), p.fingerprint}};
+}
+
 //#####################
 // GET NEW VALUES 
 //#####################
 
 // performs actions #2, #3, and #4 from above list
-// returns vector<unordered_map> where unordered_map contains new values to insert 
-std::vector<std::unordered_map<std::string, std::string>> get_new_values(std::string latest_time) { 
-  // this vector will be populated with unordered_maps full of values to insert
-  std::vector<std::unordered_map<std::string, std::string>> vals; 
+// hands vector<job_record> chunks, where each job_record contains new values
+// to insert, to sink as soon as they reach CHUNK_BYTES so that at most one
+// chunk of the log is ever held in memory no matter how much is new.
+// reading starts at from, the checkpoint of the last commit
+template <class Model>
+void get_new_values(std::string latest_time, const log_position& from, record_sink<Model> sink) { 
+  typedef job_record<Model> record;
+  // this vector will be populated with job_records full of values to insert
+  std::vector<record> vals; 
+  // memory used by vals, and the number of blocks found overall
+  size_t vals_bytes = 0;
+  unsigned long found = 0;
+  // how far the log has been dealt with: every block before done is
+  // either in vals (or an earlier chunk) or one we do not want.
+  // stuck is set while a block that is not all there yet sits after done
+  log_position done;
+  bool stuck = false;
   // check for error cade in latest_time
   if (latest_time != "EXIT") {
-    // create input stream from log file
-    std::ifstream ifs(LOGFILE);
-    // make sure the file could be opened correctly
-    if (!ifs.is_open()) {
+    // create reader over the log file(s)
+    log_reader reader;
+    // make sure the file(s) could be opened correctly
+    if (!open_logs(reader, split_paths(LOGFILE), from)) {
       std::cerr << "get_new_values(): Cannot open log file <" << LOGFILE << "> - exiting";
-      return vals;
+      close_logs(reader);
+      return;
     }
     // define key phrase that tells us we have reached a block to parse
     std::string key_phrase = "Job Complete Data:"; 
     
-    // loop until we reach the end of ifs
-    while(!ifs.eof()) {
-      // line will hold the current line
-      std::string line;
-      // grab lines delimited by \n
-      std::getline(ifs, line);
+    // line will hold the current line
+    std::string line;
+    done = log_checkpoint(reader);
+    // grab lines delimited by \n until we reach the end of the log
+    while (read_line(reader, line)) {
       // check if key_phrase exists in the current line
       if (line.find(key_phrase) != std::string::npos) {
-        // line now contains a string containing the timestamp
-        std::getline(ifs, line);
-        // first we want to determine if this is just a test print
-        // by checking the "Print Name" value which is labels[1]
-        int pos = line.find(labels[1])+labels[1].length();
-        if (line.substr(pos, 15) != "Test Check Jets") {
+        // line now contains a string containing the timestamp.
+        // if it is not all there yet we stop, and pick the block
+        // up from its start next time
+        if (!read_complete_line(reader, line)) {
+          stuck = true;
+          break;
+        }
+        // first we want to determine if this block is one we want at all
+        // (by default, that it is not just a test print). this looks at
+        // the line in place, so blocks we skip are never copied out
+        if (filter_accepts(JOB_FILTER, line)) {
           // next, grab the timestamp and check it against the previous lastest time
-          int len = line.find(labels[9]) - labels[9].length() - line.find(labels[8]);
-          std::string t = line.substr(line.find(labels[8])+labels[8].length(), len);
-          // check if this block is more recent than the last one inserted into the db
-          if (t > latest_time) { 
-            // we will populate this unordered_map with our values and push it into vals
-            std::unordered_map<std::string, std::string> block; 
-            // iterate through labels array
-            for (int i = 0; i < 24; i++) {
-              // special case when i == 23
-              if (i == 23) {
-                // for the last value we simply pull everything past the key to the end of the file
-                block.insert({keys[i], line.substr(line.find(labels[i])+labels[i].length())}); 
-              } else {
-                // find the length of the value using the difference between neighboring labels 
-                // -1 because string::find returns the index of the first char in the first match
-                len = line.find(labels[i+1]) - line.find(labels[i]) - labels[i].length() - 1;
-                block.insert({keys[i], line.substr(line.find(labels[i])+labels[i].length(), len)});
+          std::string t = peek_job_value<Model, record::TIME_STARTED>(line);
+          // check if this block is more recent than the last one inserted into the db.
+          // blocks from inside the job cache window that are not newer (same second
+          // as the latest, or out of order) are looked up in the cache by job id
+#ifdef SDC_CHECKPOINT_ONLY
+          // built for kill_test.py: trust the checkpoint alone, so
+          // a checkpoint that is off shows up as duplicated jobs
+          bool is_new = true;
+#else
+          bool is_new = t > latest_time;
+          if (!is_new && t > CACHE_FROM) {
+            is_new = !job_seen(PRINTER, peek_job_value<Model, record::JOB_ID>(line), t);
+          }
+#endif
+          if (is_new) {
+            // we will populate this job_record with our values and push it into vals,
+            // blocks that do not match the model are reported and skipped, blocks
+            // the printer is still writing are left for the next pass
+            record block; 
+            parse_result parsed = parse_job_line(line, block) ? parse_ink_lines(reader, block) : MISMATCH;
+            if (parsed == INCOMPLETE) {
+              stuck = true;
+              break;
+            }
+            // a block that does not match the model is all there and
+            // never will match, so it is dealt with like one we do not want
+            if (parsed == PARSED) {
+              block.end = log_checkpoint(reader);
+              // hand over the chunk first if this block would take it over the cap
+              size_t bytes = record_bytes(block);
+              if (!vals.empty() && vals_bytes + bytes > CHUNK_BYTES) {
+                if (!sink(vals, true, done)) {
+                  // the writer failed, the next pass starts over
+                  // from the last checkpoint that made it in
+                  std::cerr << "get_new_values(): cannot store blocks - stopping this pass" << std::endl;
+                  close_logs(reader);
+                  return;
+                }
+                vals.clear();
+                vals_bytes = 0;
               }
-            } 
-            // get rid of the 'Total Ink Usage:' line
-            std::getline(ifs, line); 
-            // now grab ink using values from next 9 lines
-            for (int i = 0; i < 9; i++) {
-              // first get the next line
-              std::getline(ifs, line);
-              // define len
-              len = line.find(labels[25]) - line.find(labels[24]) - labels[24].length() -1;
-              // then grab and insert the value 
-              block.insert({keys[24+i], line.substr(line.find(labels[24])+labels[24].length(), len)});      
-            } 
-            // push our populated map of values from the block into the val vector 
-            vals.push_back(block); 
+              // push our populated record from the block into the val vector 
+              vals.push_back(block); 
+              vals_bytes += bytes;
+              found++;
+            }
           }
         }
+        // the block is dealt with, one way or another
+        done = log_checkpoint(reader);
+        stuck = false;
       } 
     } 
+    // lines after the last block have nothing we want either
+    if (!stuck) {
+      done = log_checkpoint(reader);
+    }
+    close_logs(reader);
+  }
+  std::cout << "get_new_values(): Found " << found << " new blocks of data!" << std::endl;
+  // whatever is left is the last chunk
+  sink(vals, false, done);
+}
+
+//#####################
+// LOOKUP IDS
+//#####################
+
+// db ids of the lookup table rows we have already resolved,
+// keyed by the interned ids of the values they hold so that
+// we only have to ask the db about each printer/media once
+std::unordered_map<int, int> PRINTER_IDS;
+std::map<std::tuple<int, int, int>, int> MEDIA_IDS;
+
+// runs insert (which should be an INSERT OR IGNORE into a lookup
+// table) followed by select and returns the id it selects, or -1
+int get_lookup_id(sqlite3* db, const sql_statement& insert, const sql_statement& select) {
+  int id = -1;
+  if (!run_statement(db, insert)) {
+    std::cerr << "SQLITE3: cannot execute lookup insert <" << sqlite3_errmsg(db) << '>' << std::endl;
+    return id;
+  }
+  // define our id callback as a lambda for easy visibility
+  auto id_row = [&id](sqlite3_stmt* row) {
+    id = sqlite3_column_int(row, 0);
+  };
+  if (!run_statement(db, select, id_row)) {
+    std::cerr << "SQLITE3: cannot execute lookup select <" << sqlite3_errmsg(db) << '>' << std::endl;
+    return -1;
+  }
+  return id;
+}
+
+// returns the printer table id for the interned printer name
+int get_printer_id(sqlite3* db, int name) {
+  auto it = PRINTER_IDS.find(name);
+  if (it != PRINTER_IDS.end()) {
+    return it->second;
+  }
+  int id = get_lookup_id(db,
+      {"INSERT OR IGNORE INTO printer (name) VALUES (?);", {lookup(name)}},
+      {"SELECT id FROM printer WHERE name = ?;", {lookup(name)}});
+  if (id != -1) {
+    PRINTER_IDS.insert({name, id});
   }
-  std::cout << "get_new_values(): Found " << vals.size() << " new blocks of data!" << std::endl;
-  return vals;
+  return id;
+}
+
+// returns the media table id for the interned media name, type and units
+int get_media_id(sqlite3* db, int name, int type, int units) {
+  auto key = std::make_tuple(name, type, units);
+  auto it = MEDIA_IDS.find(key);
+  if (it != MEDIA_IDS.end()) {
+    return it->second;
+  }
+  std::vector<std::string> values = {lookup(name), lookup(type), lookup(units)};
+  int id = get_lookup_id(db,
+      {"INSERT OR IGNORE INTO media (name, type, units) VALUES (?, ?, ?);", values},
+      {"SELECT id FROM media WHERE name = ? AND type = ? AND units = ?;", values});
+  if (id != -1) {
+    MEDIA_IDS.insert({key, id});
+  }
+  return id;
 }
 
 //#####################
 // INSERT NEW VALUES 
 //#####################
 
-// performs action #5 above
-void insert_new_values(std::vector<std::unordered_map<std::string, std::string>> vals) {
+// performs action #5 above. rows are handed to the commit
+// scheduler, which commits them in batches, each row along with the
+// checkpoint just past its block. a chunk that was cut short by the
+// memory cap is committed before parsing carries on. returns false
+// if a row could not be stored, nothing past it may be checkpointed
+template <class Model>
+bool insert_new_values(std::vector<job_record<Model>>& vals, bool more, const log_position& upto) {
+  typedef job_record<Model> record;
+  // we begin by opening the writer's
+  // connection to the database
+  if (!open_writer()) {
+    return false;
+  }
+  sqlite3* db = WRITER_DB;
+  // every row in this run belongs to the same printer
+  int printer_id = get_printer_id(db, intern(PRINTER));
+  if (printer_id == -1) {
+    std::cerr << "insert_new_values: cannot resolve printer id for <" << PRINTER << '>' << std::endl;
+    return false;
+  }
   // check size of vals vector before we continue
   if (vals.size() == 0) {
     // there are no new values to insert
-    std::cout << "insert_new_values: There are no new blocks of data to insert - exiting." << std::endl;
+    std::cout << "insert_new_values: There are no new blocks of data to insert." << std::endl;
   } else {
     // there are blocks to insert.
-    // we begin by opening the database
-    // like we did above.  
-    sqlite3* db;
-    char* err_msg = 0;
-    int rc = sqlite3_open("sdc_printer.db", &db);
-    std::string sql;
-
-    // test if opening the db was successful
-    if (rc) {
-      std::cerr << "SQLITE3: cannot open database <" << sqlite3_errmsg(db) << '>' << std::endl; 
-    } else {
-      std::cout << "SQLITE3: opened database successfully" << std::endl;
-      // now we iterate through the vals vector, inserting the values stored in each unordered_map
-      for (int i = 0; i < vals.size(); i++) { 
-        // first we need to construct the query string
-        std::string sql = "INSERT INTO print_jobs (" \
-              "printer_name, job_id, job_name, print_function, copies_printed, total_copies, completed," \
-              "canceled, doublesided, time_started, time_duration, time_units, image_width," \
-              "image_length, media_length, prints_per_job, media_name, media_integrationid, type," \
-              "media_width, media_height, media_grade, media_offset, media_units, sqft_media_printed," \
-              "c_ink, m_ink, y_ink, k_ink, lc_ink, lm_ink, ly_ink, lk_ink, w_ink)" \
-              " VALUES (";
-        sql += "'" + PRINTER + "',";                        // printer_name 
-        sql += "'" + vals[i]["job_id"] + "',";              // job_id
-        sql += "'" + vals[i]["job_name"] + "',";            // job_name
-        sql += "'" + vals[i]["print_function"] + "',";      // print_function
-        sql += "'" + vals[i]["copies_printed"] + "',";      // copies_printed
-        sql += "'" + vals[i]["total_copies"] + "',";        // total_copies
-        sql += "'" + vals[i]["completed"] + "',";           // completed
-        sql += "'" + vals[i]["canceled"] + "',";            // canceled
-        sql += "'" + vals[i]["doublesided"] + "',";         // doublesided
-        sql += "'" + vals[i]["time_started"] + "',";        // time_started
-        sql += "'" + vals[i]["time_duration"] + "',";       // time_duration
-        sql += "'" + vals[i]["time_unites"] + "',";         // time_units
-        sql += "'" + vals[i]["image_width"] + "',";         // image_width
-        sql += "'" + vals[i]["image_length"] + "',";        // image_length
-        sql += "'" + vals[i]["media_length"] + "',";        // media_length
-        sql += "'" + vals[i]["prints_per_job"] + "',";      // prints_per_job
-        sql += "'" + vals[i]["media_name"] + "',";          // media_name
-        sql += "'" + vals[i]["media_integrationid"] + "',"; // media_integrationid
-        sql += "'" + vals[i]["type"] + "',";                // type
-        sql += "'" + vals[i]["media_width"] + "',";         // media_width
-        sql += "'" + vals[i]["media_height"] + "',";        // media_height
-        sql += "'" + vals[i]["media_grade"] + "',";         // media_grade
-        sql += "'" + vals[i]["media_offset"] + "',";        // media_offset
-        sql += "'" + vals[i]["media_units"] + "',";         // media_units
-        sql += "'" + vals[i]["sqft_media_printed"] + "',";  // sqft_media_printed
-        sql += "'" + vals[i]["c_ink"] + "',";               // c_ink 
-        sql += "'" + vals[i]["m_ink"] + "',";               // m_ink  
-        sql += "'" + vals[i]["y_ink"] + "',";               // y_ink 
-        sql += "'" + vals[i]["k_ink"] + "',";               // k_ink
-        sql += "'" + vals[i]["lc_ink"] + "',";              // lc_ink
-        sql += "'" + vals[i]["lm_ink"] + "',";              // lm_ink
-        sql += "'" + vals[i]["ly_ink"] + "',";              // ly_ink
-        sql += "'" + vals[i]["lk_ink"] + "',";              // lk_ink
-        sql += "'" + vals[i]["w_ink"] + "'";                // w_ink 
-        sql += ");";
-        
-        // next we execute the statement 
-        rc = sqlite3_exec(db, sql.c_str(), NULL, NULL, &err_msg);
-        if (rc) {
-          // something went wrong with our selection
-          std::cerr << "SQLITE3: cannot execute insert statement <" << sqlite3_errmsg(db) << '>' << std::endl;
-          sqlite3_free(err_msg);
-          // cut the program short 
-        } else {
-          std::cout << "SQLITE3: insert query executed successfully for vals[" << i << ']' << std::endl; 
-        }
+    // now we iterate through the vals vector, inserting the values stored in each job_record
+    for (unsigned int i = 0; i < vals.size(); i++) { 
+      const record& r = vals[i];
+      int media_id = get_media_id(db, r.ref[record::MEDIA], r.ref[record::TYPE], r.ref[record::UNITS]);
+      if (media_id == -1) {
+        // the rows queued so far only checkpoint up to the block
+        // before this one, so they can still go in
+        std::cerr << "insert_new_values: cannot resolve media id for vals[" << i << ']' << std::endl;
+        flush_rows();
+        return false;
+      }
+      // next we queue the statement, the job goes into the
+      // job cache once the batch it is in has been committed
+      schedule_row({insert_sql<Model>(), insert_values(r, printer_id, media_id)},
+                   job_key(PRINTER, r.text[record::JOB_ID], r.text[record::TIME_STARTED]),
+                   checkpoint_statement(printer_id, r.end));
+      if (COMMIT_FAILED) {
+        return false;
       }
     }
   }
+  // the blocks we skipped after the last row are dealt with too,
+  // this goes in with the next commit
+  if (!upto.segment.empty()) {
+    schedule_checkpoint(checkpoint_statement(printer_id, upto));
+  }
+  if (more) {
+    flush_rows();
+  }
+  return !COMMIT_FAILED;
 }
 
 
+// runs the program for a log from a Model printer
+template <class Model>
+void run() {
+  // tell the job cache where this model keeps its jobs
+  JOB_TABLE = Model::table;
+  // the filter names the model's columns, so it is compiled here, once
+  if (!compile_filter<Model>(FILTER, JOB_FILTER)) {
+    std::cerr << "run(): cannot compile filter <" << FILTER << "> - exiting" << std::endl;
+    return;
+  }
+
+  // run continuously
+  while (true) { 
+    // anything still waiting is committed first so the
+    // db and job cache agree with what we already parsed
+    flush_rows();
+    // a failed commit dropped its rows, this pass reads them
+    // again from the last checkpoint that made it in
+    begin_pass();
+    std::string latest_time = get_latest_time<Model>();
+    // (re)warm the job cache once the tables are known to exist
+    if (latest_time != "EXIT" && job_cache_stale()) {
+      warm_job_cache(PRINTER);
+    }
+    if (latest_time != "EXIT") {
+      get_new_values<Model>(latest_time, get_checkpoint(), insert_new_values<Model>);
+    }
+    // sleep for a minute, waking up early to commit
+    // any rows whose batch deadline comes up first
+    auto next_poll = std::chrono::steady_clock::now() + std::chrono::seconds(60);
+    while (std::chrono::steady_clock::now() < next_poll) {
+      std::this_thread::sleep_until(std::min(next_poll, commit_deadline()));
+      flush_due();
+    }
+  }
+}
+
 //~~~~~~~~~~~~~~~~~~~~~
 //~~~~~~~~~~~~~~~~~~~~~
 //        MAIN 
@@ -452,25 +584,56 @@ void insert_new_values(std::vector<std::unordered_map<std::string, std::string>>
 int main(int argc, char* argv[]) { 
   // set global values using cl params
   if (argc < 3) {
-    std::cerr << "main(): not enough params, need <filepath> <printer name> - exiting" << std::endl; 
+    std::cerr << "main(): not enough params, need <filepath> <printer name>[:<model>] [cache days] " \
+        "[batch size] [batch delay ms] [durability off|normal|full] [chunk KB] [filter] - exiting" << std::endl; 
     return 0;
   }
   LOGFILE = std::string(argv[1]);
   PRINTER = std::string(argv[2]);
+  // the printer's model can follow its name, e.g. "A:vutek_4c"
+  if (PRINTER.find(':') != std::string::npos) {
+    MODEL = PRINTER.substr(PRINTER.find(':') + 1);
+    PRINTER = PRINTER.substr(0, PRINTER.find(':'));
+  }
+  if (argc > 3) {
+    CACHE_DAYS = atoi(argv[3]);
+  }
+  if (argc > 4) {
+    BATCH_SIZE = atoi(argv[4]);
+  }
+  if (argc > 5) {
+    BATCH_DELAY = std::chrono::milliseconds(atoi(argv[5]));
+  }
+  if (argc > 6) {
+    DURABILITY = std::string(argv[6]);
+    if (synchronous_mode(DURABILITY).empty()) {
+      std::cerr << "main(): unknown durability <" << DURABILITY << ">, need off, normal or full - exiting" << std::endl;
+      return 1;
+    }
+  }
+  if (argc > 7) {
+    CHUNK_BYTES = atoi(argv[7]) * 1024;
+  }
+  if (argc > 8) {
+    FILTER = std::string(argv[8]);
+  }
   std::cout << "main(): LOGFILE = <" << LOGFILE << '>' << std::endl;
   std::cout << "main(): PRINTER = <" << PRINTER << '>' << std::endl;
+  std::cout << "main(): MODEL = <" << MODEL << '>' << std::endl;
+  std::cout << "main(): CACHE_DAYS = <" << CACHE_DAYS << '>' << std::endl;
+  std::cout << "main(): BATCH_SIZE = <" << BATCH_SIZE << '>' << std::endl;
+  std::cout << "main(): BATCH_DELAY = <" << BATCH_DELAY.count() << " ms>" << std::endl;
+  std::cout << "main(): DURABILITY = <" << DURABILITY << '>' << std::endl;
+  std::cout << "main(): CHUNK_BYTES = <" << CHUNK_BYTES << '>' << std::endl;
+  std::cout << "main(): FILTER = <" << FILTER << '>' << std::endl;
    
   /*std::string filepath = "print_log.csv";
   char delimiter[] = "|";
   auto foo = parse_csv(filepath, delimiter, 25);
   std::cout << "main(): csv length = " << foo.size() << std::endl;*/
 
-  // run continuously
-  while (true) { 
-    insert_new_values(get_new_values(get_latest_time()));
-    // sleep for 5 minutes
-    std::this_thread::sleep_for(std::chrono::seconds(60));
-  }
+  // run continuously with the parser for the printer's model
+  with_model(MODEL, [](auto model) { run<decltype(model)>(); });
   return 0;
 }
 
@@ -13,7 +13,10 @@
 #include <vector> 
 #include <ctime>
 #include <cstdio>
+#include <functional>
 #include "csv_parser.hpp"
+#include "log_reader.hpp"
+#include "job_filter.hpp"
 
 /*
  *
@@ -71,7 +74,8 @@ const std::string current_datetime() {
   return buf;
 }
 
-// filepath to log file
+// filepath to log file, or a comma separated list of
+// files (rotated archives first) to be read as one log
 std::string LOGFILE = "/var/log/jdfserverd.log";
 // name of printer
 std::string PRINTER = "A";
@@ -79,35 +83,10 @@ std::string PRINTER = "A";
 std::string TIMECUT;
 // output csv file
 std::string OUTFILE = "~/Desktop/print_log.csv";
-
-// define value field labels
-const std::string labels[] = {
-  "JobID: ",                    // 0
-  "Job Name: ",                 // 1
-  "Print Function: ",           // 2
-  "Copies Printed: ",           // 3
-  "Total Copies: ",             // 4
-  "Completed: ",                // 5
-  "Canceled: ",                 // 6
-  "DoubleSided: ",              // 7
-  "Time Started: ",             // 8
-  "Time Duration: ",            // 9
-  "Time Units: ",               // 10
-  "Image Width: ",              // 11
-  "Image Length: ",             // 12
-  "Media Length: ",             // 13
-  "Prints Per Job: ",           // 14
-  "Media Name: ",               // 15
-  "Media IntegrationId: ",      // 16
-  "Type: ",                     // 17
-  "Media Width: ",              // 18
-  "Media Height: ",             // 19
-  "Media Grade: ",              // 20
-  "Media Offset: ",             // 21
-  "Media Units: ",              // 22
-  "Sqft Media Printed: ",       // 23
-  "Ink Consumption: ",          // 24
-  "Ink Units: "};               // 25
+// memory cap on the parsed values held at once, in bytes
+size_t CHUNK_BYTES = 4 << 20;
+// printer model the log comes from, see schema.hpp
+std::string MODEL = "vutek_8c";
 
 //#####################
 // GET NEW VALUES 
@@ -117,78 +96,75 @@ const std::string labels[] = {
 // not be correct. This was adapted from Main()
 // to work with gen_csv()  
 
+// receives parsed records a chunk at a time
+template <class Model>
+using record_sink = std::function<void(std::vector<job_record<Model>>& vals)>;
+
 // performs actions #2, #3, and #4 from above list
-// returns map of new values to insert 
-std::map<std::string, std::vector<std::string>> get_new_values(std::string latest_time) { 
-  // this vector will be populated with unordered_maps full of values to insert
-  std::map<std::string, std::vector<std::string>> vals; 
+// hands the records of new values to sink every time they reach CHUNK_BYTES
+template <class Model>
+void get_new_values(std::string latest_time, record_sink<Model> sink) { 
+  typedef job_record<Model> record;
+  // this vector will be populated with job_records full of values to insert
+  std::vector<record> vals; 
+  // memory used by vals, and the number of blocks found overall
+  size_t vals_bytes = 0;
+  unsigned long found = 0;
   // check for error cade in latest_time
   if (latest_time != "EXIT") {
-    // create input stream from log file
-    std::ifstream ifs(LOGFILE);
-    // make sure the file could be opened correctly
-    if (!ifs.is_open()) {
+    // create reader over the log file(s)
+    log_reader reader;
+    // make sure the file(s) could be opened correctly
+    if (!open_logs(reader, split_paths(LOGFILE))) {
       std::cerr << "get_new_values(): Cannot open log file <" << LOGFILE << "> - exiting";
-      return vals;
+      close_logs(reader);
+      return;
     }
     // define key phrase that tells us we have reached a block to parse
     std::string key_phrase = "Job Complete Data:"; 
     
-    // loop until we reach the end of ifs
-    while(!ifs.eof()) {
-      // line will hold the current line
-      std::string line;
-      // grab lines delimited by \n
-      std::getline(ifs, line);
+    // line will hold the current line
+    std::string line;
+    // grab lines delimited by \n until we reach the end of the log
+    while (read_line(reader, line)) {
       // check if key_phrase exists in the current line
       if (line.find(key_phrase) != std::string::npos) {
         // line now contains a string containing the timestamp
-        std::getline(ifs, line);
-        // first we want to determine if this is just a test print
-        // by checking the "Print Name" value which is labels[1]
-        int pos = line.find(labels[1])+labels[1].length();
-        if (line.substr(pos, 15) != "Test Check Jets") {
+        read_line(reader, line);
+        // first we want to determine if this block is one we want at all
+        // (by default, that it is not just a test print). this looks at
+        // the line in place, so blocks we skip are never copied out
+        if (filter_accepts(JOB_FILTER, line)) {
           // next, grab the timestamp and check it against the previous lastest time
-          int len = line.find(labels[9]) - labels[9].length() - line.find(labels[8]);
-          std::string t = line.substr(line.find(labels[8])+labels[8].length(), len);
+          std::string t = peek_job_value<Model, record::TIME_STARTED>(line);
           // check if this block is more recent than the last one inserted into the db
           if (t > latest_time) { 
-            // iterate through labels array
-            for (int i = 0; i < 24; i++) {
-              // special case when i == 23
-              if (i == 23) {
-                // for the last value we simply pull everything past the key to the end of the file
-                //block.insert({keys[i], line.substr(line.find(labels[i])+labels[i].length())}); 
-                vals[keys[i]].push_back(line.substr(line.find(labels[i])+labels[i].length()));
-              } else {
-                // find the length of the value using the difference between neighboring labels 
-                // -1 because string::find returns the index of the first char in the first match
-                len = line.find(labels[i+1]) - line.find(labels[i]) - labels[i].length() - 1;
-                //block.insert({keys[i], line.substr(line.find(labels[i])+labels[i].length(), len)});
-                vals[keys[i]].push_back(line.substr(line.find(labels[i])+labels[i].length(), len));
-              }
-            } 
-            // get rid of the 'Total Ink Usage:' line
-            std::getline(ifs, line); 
-            // now grab ink using values from next 9 lines
-            for (int i = 0; i < 9; i++) {
-              // first get the next line
-              std::getline(ifs, line);
-              // define len
-              len = line.find(labels[25]) - line.find(labels[24]) - labels[24].length() -1;
-              // then grab and insert the value 
-              //block.insert({keys[24+i], line.substr(line.find(labels[24])+labels[24].length(), len)});      
-              vals[keys[24+i]].push_back(line.substr(line.find(labels[24])+labels[24].length(), len));
-            } 
-            // push our populated map of values from the block into the val vector 
-            //vals.push_back(block); 
+            // blocks that do not match the model are reported and skipped
+            record block;
+            if (!parse_job_line(line, block) || parse_ink_lines(reader, block) != PARSED) {
+              continue;
+            }
+            // push our populated record from the block into the val vector 
+            vals.push_back(block); 
+            vals_bytes += record_bytes(block);
+            found++;
+            // hand over the chunk once it reaches the cap
+            if (vals_bytes >= CHUNK_BYTES) {
+              sink(vals);
+              vals.clear();
+              vals_bytes = 0;
+            }
           }
         }
       } 
     } 
+    close_logs(reader);
+  }
+  std::cout << "get_new_values(): Found " << found << " new blocks of data!" << std::endl;
+  // whatever is left is the last chunk
+  if (!vals.empty()) {
+    sink(vals);
   }
-  std::cout << "get_new_values(): Found " << vals[keys[0]].size() << " new blocks of data!" << std::endl;
-  return vals;
 }
 
 //~~~~~~~~~~~~~~~~~~~~~
@@ -211,10 +187,22 @@ int main(int argc, char* argv[]) {
   //OUTFILE = std::string(argv[4]);
   std::cout << "main(): LOGFILE = <" << LOGFILE << '>' << std::endl;
   std::cout << "main(): PRINTER = <" << PRINTER << '>' << std::endl;
+  std::cout << "main(): MODEL = <" << MODEL << '>' << std::endl;
   std::cout << "main(): TIMECUT = <" << TIMECUT << '>' << std::endl;
   std::cout << "main(): OUTFILE = <" << OUTFILE << '>' << std::endl; 
+  std::cout << "main(): FILTER = <" << FILTER << '>' << std::endl;
 
-  //gen_csv(get_new_values(TIMECUT), OUTFILE); 
+  /*std::ofstream ofs(OUTFILE);
+  with_model(MODEL, [&ofs](auto model) {
+    typedef decltype(model) Model;
+    if (!compile_filter<Model>(FILTER, JOB_FILTER)) {
+      return;
+    }
+    gen_csv_header<Model>(ofs);
+    get_new_values<Model>(TIMECUT, [&ofs](std::vector<job_record<Model>>& vals) {
+      append_csv<Model>(ofs, vals);
+    });
+  });*/
   return 0;
 }
 
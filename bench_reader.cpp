@@ -0,0 +1,129 @@
+// ###################################
+// Name: bench_reader
+// Desc: Times reading log files with an ifstream,
+//       with log_reader over pread, and with
+//       log_reader over io_uring
+// ###################################
+
+/* Inclusions */
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include "log_reader.hpp"
+
+/*
+ * Usage: bench.o <ifstream|pread|uring> <runs> <file> [file ...]
+ *
+ * Before every run the files are dropped from the page cache so that
+ * each run reads from the disk. As root that is done for the whole
+ * system through /proc/sys/vm/drop_caches, otherwise only the files'
+ * own pages are dropped with posix_fadvise(DONTNEED), which does not
+ * reach any cache below this machine (a vm host, a NAS). Which one
+ * was used is printed with the results, numbers taken without
+ * drop_caches should not be read as cold reads.
+ *
+ * Prints the lines and bytes read (which should match between modes)
+ * and min / median / max of the runs in ms.
+ *
+ * Results so far (median ms, drop_caches before every run):
+ *
+ *   file                         ifstream   pread    uring
+ *   59 MB log                       48 ms    60 ms    58 ms
+ *   41 MB synthetic log, 9 runs     31 ms    41 ms    43 ms
+ *   same again                      30 ms    44 ms    42 ms
+ *
+ * Both were taken on a 1 cpu vm (linux 6.18) whose disk is a file on
+ * the host. drop_caches only empties the guest's page cache, the host
+ * very likely still had the file cached, so these are reads from the
+ * host's memory rather than from a disk. They say nothing about a
+ * slow or busy disk, which is where keeping reads in flight could
+ * help. On them ifstream is the fastest and io_uring is no faster than
+ * pread, so the reader uses pread unless USE_URING is set. Numbers
+ * from the print server's own disk are still to be taken.
+ *
+ * */
+
+// drops the files from the page cache, returns true if
+// the whole system's page cache could be dropped
+bool drop_caches(const std::vector<std::string>& paths) {
+  for (unsigned int i = 0; i < paths.size(); i++) {
+    int fd = open(paths[i].c_str(), O_RDONLY);
+    if (fd >= 0) {
+      fdatasync(fd);
+      posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+      close(fd);
+    }
+  }
+  sync();
+  std::ofstream ofs("/proc/sys/vm/drop_caches");
+  ofs << "3" << std::endl;
+  return ofs.good();
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 4) {
+    std::cerr << "main(): not enough params, need <ifstream|pread|uring> <runs> <file> [file ...] - exiting" << std::endl;
+    return 1;
+  }
+  std::string mode = argv[1];
+  int runs = atoi(argv[2]);
+  std::vector<std::string> paths(argv + 3, argv + argc);
+  if (mode != "ifstream" && mode != "pread" && mode != "uring") {
+    std::cerr << "main(): unknown mode <" << mode << "> - exiting" << std::endl;
+    return 1;
+  }
+  USE_URING = mode == "uring";
+
+  std::vector<double> times;
+  unsigned long lines = 0;
+  unsigned long bytes = 0;
+  bool cold = true;
+  for (int run = 0; run < runs; run++) {
+    cold = drop_caches(paths) && cold;
+    lines = bytes = 0;
+    std::string line;
+    auto start = std::chrono::steady_clock::now();
+    if (mode == "ifstream") {
+      for (unsigned int i = 0; i < paths.size(); i++) {
+        std::ifstream ifs(paths[i]);
+        while (std::getline(ifs, line)) {
+          lines++;
+          bytes += line.size();
+        }
+      }
+    } else {
+      log_reader reader;
+      if (!open_logs(reader, paths)) {
+        std::cerr << "main(): cannot open log files - exiting" << std::endl;
+        return 1;
+      }
+      if (mode == "uring" && !using_uring(reader)) {
+        std::cerr << "main(): io_uring not available - exiting" << std::endl;
+        close_logs(reader);
+        return 1;
+      }
+      while (read_line(reader, line)) {
+        lines++;
+        bytes += line.size();
+      }
+      close_logs(reader);
+    }
+    auto end = std::chrono::steady_clock::now();
+    times.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+  }
+  if (times.empty()) {
+    return 0;
+  }
+  std::sort(times.begin(), times.end());
+  std::cout << mode << ": " << lines << " lines, " << bytes << " bytes, "
+            << times.front() << " / " << times[times.size() / 2] << " / " << times.back()
+            << " ms (min / median / max of " << times.size() << " runs, page cache dropped with "
+            << (cold ? "drop_caches" : "posix_fadvise only, NOT cold reads") << ')' << std::endl;
+  return 0;
+}
@@ -0,0 +1,252 @@
+/*
+ * This is the group commit scheduler used by the writer. Rather
+ * than committing every row on its own, rows are queued up and
+ * committed together in a single transaction once either:
+ * 1. BATCH_SIZE rows are waiting, or
+ * 2. the oldest waiting row has waited BATCH_DELAY
+ *
+ * A small BATCH_DELAY keeps the ingest lag low when the printer is
+ * idle, a large BATCH_SIZE gives high throughput during backfills.
+ * How hard sqlite syncs each commit to disk is set by DURABILITY.
+ *
+ * Along with the rows the caller can hand over a checkpoint, a
+ * statement recording how far the log has been consumed. The latest
+ * one is run inside the same transaction as the rows it covers, so
+ * the db either has both the rows and the checkpoint or neither, no
+ * matter where the process is killed.
+ *
+ * A batch goes in whole or not at all. If a row or the commit fails,
+ * the batch is rolled back and dropped and the scheduler refuses
+ * anything more until begin_pass(): a later checkpoint must never be
+ * committed past rows that did not make it in. The caller is to stop
+ * reading the log and start the next pass from the checkpoint in the
+ * db, which reads the dropped rows again.
+ *
+ * After each commit the batch size and commit latency are reported
+ * along with running averages so the two can be tuned.
+ *
+ */
+
+#pragma once
+
+/* Inclusions */
+#include <string>
+#include <vector>
+#include <chrono>
+#include <iostream>
+#include <sqlite3.h>
+#include "job_cache.hpp"
+#include "sql_statement.hpp"
+
+// flush once this many rows are waiting
+unsigned int BATCH_SIZE = 500;
+// flush once the oldest waiting row has waited this long
+std::chrono::milliseconds BATCH_DELAY(1000);
+// durability mode, maps onto sqlite's synchronous pragma:
+// "off" (fastest, a crash of the os can lose commits),
+// "normal" (a crash of the os can lose the last commits),
+// "full" (every commit is on disk before we continue)
+std::string DURABILITY = "normal";
+
+// a row waiting to be committed, key is its job cache key
+struct pending_row {
+  sql_statement row;
+  std::string key;
+};
+
+// rows waiting for the next commit, and when the first one (or a
+// checkpoint with no rows) arrived
+std::vector<pending_row> PENDING;
+std::chrono::steady_clock::time_point PENDING_SINCE;
+// checkpoint statement covering the rows handed over so far, run
+// last in the next commit. empty sql if there is nothing new to record
+sql_statement CHECKPOINT;
+// set when a batch could not be committed, until begin_pass()
+bool COMMIT_FAILED = false;
+// connection all commits go through
+sqlite3* WRITER_DB = NULL;
+
+// running totals for reporting
+unsigned long COMMIT_COUNT = 0;
+unsigned long COMMIT_ROWS = 0;
+double COMMIT_TOTAL_MS = 0;
+double COMMIT_MAX_MS = 0;
+
+// returns the synchronous pragma value for durability mode d, or "" if there is none
+std::string synchronous_mode(const std::string& d) {
+  if (d == "off") {
+    return "OFF";
+  } else if (d == "normal") {
+    return "NORMAL";
+  } else if (d == "full") {
+    return "FULL";
+  }
+  return "";
+}
+
+// opens the writer connection and applies the durability mode.
+// a connection the mode could not be applied to is not used
+bool open_writer() {
+  if (WRITER_DB != NULL) {
+    return true;
+  }
+  int rc = sqlite3_open("sdc_printer.db", &WRITER_DB);
+  if (rc) {
+    std::cerr << "SQLITE3: cannot open database <" << sqlite3_errmsg(WRITER_DB) << '>' << std::endl;
+    sqlite3_close(WRITER_DB);
+    WRITER_DB = NULL;
+    return false;
+  }
+  sqlite3_busy_timeout(WRITER_DB, BUSY_TIMEOUT_MS);
+  std::string sync = synchronous_mode(DURABILITY);
+  // WAL lets the job cache keep reading while we write, and is
+  // what makes synchronous=NORMAL safe against a crash of the app
+  std::string sql = "PRAGMA journal_mode=WAL; PRAGMA synchronous=" + sync + ";";
+  char* err_msg = 0;
+  rc = sqlite3_exec(WRITER_DB, sql.c_str(), NULL, NULL, &err_msg);
+  if (rc) {
+    // try again with a fresh connection next time
+    std::cerr << "SQLITE3: cannot set durability mode <" << sqlite3_errmsg(WRITER_DB) << '>' << std::endl;
+    sqlite3_free(err_msg);
+    sqlite3_close(WRITER_DB);
+    WRITER_DB = NULL;
+    return false;
+  }
+  std::cout << "SQLITE3: writer opened with synchronous=" << sync << std::endl;
+  return true;
+}
+
+// drops the batch after a failure and refuses anything more
+void fail_batch() {
+  sqlite3_exec(WRITER_DB, "ROLLBACK;", NULL, NULL, NULL);
+  PENDING.clear();
+  CHECKPOINT = sql_statement();
+  COMMIT_FAILED = true;
+}
+
+// commits every pending row, and the checkpoint, in a single transaction
+void flush_rows() {
+  if (COMMIT_FAILED || (PENDING.empty() && CHECKPOINT.sql.empty()) || !open_writer()) {
+    return;
+  }
+  auto start = std::chrono::steady_clock::now();
+  char* err_msg = 0;
+  std::vector<std::string> inserted;
+  int rc = sqlite3_exec(WRITER_DB, "BEGIN;", NULL, NULL, &err_msg);
+  if (rc) {
+    std::cerr << "SQLITE3: cannot begin batch of " << PENDING.size() << " rows <" << sqlite3_errmsg(WRITER_DB) << '>' << std::endl;
+    sqlite3_free(err_msg);
+    fail_batch();
+    return;
+  }
+  for (unsigned int i = 0; i < PENDING.size(); i++) {
+    if (!run_statement(WRITER_DB, PENDING[i].row)) {
+      // committing the rest (and the checkpoint past this one)
+      // would lose this job for good, so the batch goes as a whole
+      std::cerr << "SQLITE3: cannot execute insert statement <" << sqlite3_errmsg(WRITER_DB) << "> - dropping batch of "
+                << PENDING.size() << " rows" << std::endl;
+      fail_batch();
+      return;
+    }
+    inserted.push_back(PENDING[i].key);
+  }
+  // a batch must not go in without its checkpoint, or
+  // the next run would read its jobs a second time
+  if (!CHECKPOINT.sql.empty() && !run_statement(WRITER_DB, CHECKPOINT)) {
+    std::cerr << "SQLITE3: cannot execute checkpoint statement <" << sqlite3_errmsg(WRITER_DB) << "> - dropping batch of "
+              << PENDING.size() << " rows" << std::endl;
+    fail_batch();
+    return;
+  }
+  rc = sqlite3_exec(WRITER_DB, "COMMIT;", NULL, NULL, &err_msg);
+  if (rc) {
+    // nothing from this batch made it in. the jobs are not in the
+    // job cache either, and the checkpoint is still the one before
+    // them, so the next pass over the log picks them up
+    std::cerr << "SQLITE3: cannot commit batch of " << PENDING.size() << " rows <" << sqlite3_errmsg(WRITER_DB) << '>' << std::endl;
+    sqlite3_free(err_msg);
+    fail_batch();
+    return;
+  }
+  CHECKPOINT = sql_statement();
+  if (inserted.empty()) {
+    // only the checkpoint moved, nothing worth reporting
+    PENDING.clear();
+    return;
+  }
+  auto end = std::chrono::steady_clock::now();
+  double ms = std::chrono::duration<double, std::milli>(end - start).count();
+  double waited = std::chrono::duration<double, std::milli>(end - PENDING_SINCE).count();
+  for (unsigned int i = 0; i < inserted.size(); i++) {
+    remember_job(inserted[i]);
+  }
+
+  // update and report the running totals, which only
+  // count the commits that actually inserted rows
+  COMMIT_COUNT++;
+  COMMIT_ROWS += inserted.size();
+  COMMIT_TOTAL_MS += ms;
+  if (ms > COMMIT_MAX_MS) {
+    COMMIT_MAX_MS = ms;
+  }
+  std::cout << "flush_rows(): committed " << inserted.size() << " rows in " << ms << " ms"
+            << ", oldest row waited " << waited << " ms"
+            << " (avg batch " << static_cast<double>(COMMIT_ROWS) / COMMIT_COUNT
+            << ", avg commit " << COMMIT_TOTAL_MS / COMMIT_COUNT << " ms"
+            << ", max commit " << COMMIT_MAX_MS << " ms)" << std::endl;
+  PENDING.clear();
+}
+
+// returns when the pending rows (or checkpoint) are due, or max() if there are none
+std::chrono::steady_clock::time_point commit_deadline() {
+  if (PENDING.empty() && CHECKPOINT.sql.empty()) {
+    return std::chrono::steady_clock::time_point::max();
+  }
+  return PENDING_SINCE + BATCH_DELAY;
+}
+
+// commits the pending rows if their deadline has passed
+void flush_due() {
+  if (std::chrono::steady_clock::now() >= commit_deadline()) {
+    flush_rows();
+  }
+}
+
+// starts a new pass over the log, after a failed commit the
+// scheduler takes rows again from here on
+void begin_pass() {
+  COMMIT_FAILED = false;
+}
+
+// sets the checkpoint the next commit records, without forcing one.
+// a checkpoint on its own is committed after BATCH_DELAY like a row
+void schedule_checkpoint(const sql_statement& checkpoint) {
+  if (COMMIT_FAILED) {
+    return;
+  }
+  if (PENDING.empty() && CHECKPOINT.sql.empty()) {
+    PENDING_SINCE = std::chrono::steady_clock::now();
+  }
+  CHECKPOINT = checkpoint;
+}
+
+// queues a row for the next commit, committing if the batch is full.
+// checkpoint, if given, is where the log is up to once the row is in.
+// rows are refused after a failed commit, see COMMIT_FAILED
+void schedule_row(const sql_statement& row, const std::string& key, const sql_statement& checkpoint = sql_statement()) {
+  if (COMMIT_FAILED) {
+    return;
+  }
+  if (PENDING.empty()) {
+    PENDING_SINCE = std::chrono::steady_clock::now();
+  }
+  PENDING.push_back({row, key});
+  if (!checkpoint.sql.empty()) {
+    CHECKPOINT = checkpoint;
+  }
+  if (PENDING.size() >= BATCH_SIZE) {
+    flush_rows();
+  } else {
+    flush_due();
+  }
+}
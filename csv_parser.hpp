@@ -12,48 +12,7 @@
 #include <iostream>
 #include <fstream> 
 #include <string.h> 
-
-// 'clean' versions of the above labels
-// for use as keys and attribute names
-const std::string keys[] = {
-  "job_id",                     // 0
-  "job_name",                   // 1
-  "print_function",             // 2
-  "copies_printed",             // 3
-  "total_copies",               // 4
-  "completed",                  // 5
-  "cancelled",                  // 6
-  "doublesided",                // 7
-  "time_started",               // 8
-  "time_duration",              // 9
-  "time_units",                 // 10
-  "image_width",                // 11
-  "image_length",               // 12
-  "media_length",               // 13
-  "prints_per_job",             // 14
-  "media_name",                 // 15
-  "media_integrationid",        // 16
-  "type",                       // 17
-  "media_width",                // 18
-  "media_height",               // 19
-  "media_grade",                // 20
-  "media_offset",               // 21
-  "media_units",                // 22
-  "sqft_media_printed",         // 23
-
- // ink keys
-
-  "c_ink",                      // 24
-  "m_ink",                      // 25
-  "y_ink",                      // 26
-  "k_ink",                      // 27
-  "lc_ink",                     // 28
-  "lm_ink",                     // 29
-  "ly_ink",                     // 30
-  "lk_ink",                     // 31
-  "w_ink"};                     // 32
-
-
+#include "schema.hpp"
 
 // this function parses a csv file and returns the rows in a map
 std::map<std::string, std::vector<std::string>>
@@ -97,33 +56,40 @@ parse_csv(std::string filename, char* delimiter, int column_count) {
   return csv;
 }
 
-// this function takes a map of vectors and generates a csv
-void gen_csv(std::map<std::string, std::vector<std::string>> data, std::string out) { 
-  
-  // open ofstream for output
-  std::ofstream ofs(out); 
-  if (!ofs.is_open()) {
-    std::cerr << "gen_csv: Cannot create/open output file <" << out << "> - exiting";
-    return; 
-  }
-  
-  // iterate through keys, creating column value line
+// this function writes the column name line of a csv of Model records
+template <class Model>
+void gen_csv_header(std::ofstream& ofs) {
+
+  // iterate through the columns of Model, creating column value line
   std::string column_row = "";
   char delim = '|';
 
-  for (int i = 0; i < 33; i++) {
-    column_row += '"' + keys[i] + '"' + delim;
+  for (size_t i = 0; i < std::size(Model::job); i++) {
+    column_row += std::string("\"") + Model::job[i].column + '"' + delim;
+  }
+  for (size_t i = 0; i < std::size(Model::inks); i++) {
+    column_row += std::string("\"") + Model::inks[i].column + '"' + delim;
   }
   
   column_row = column_row.substr(0, column_row.size()-1);
   column_row += '\n';
   ofs << column_row;
-  
-  // iterate through vectors, creating each subsequent line 
+}
+
+// this function appends Model records to a csv, so a csv
+// can be written a chunk at a time after gen_csv_header()
+template <class Model>
+void append_csv(std::ofstream& ofs, const std::vector<job_record<Model>>& data) {
+  char delim = '|';
+
+  // iterate through records, creating each subsequent line 
   std::string data_row = "";
-  for (unsigned int i = 0; i < data[keys[1]].size(); i++) {
-    for (unsigned int j = 0; j < data.size(); j++) {
-      data_row += '"' + data[keys[j]][i] + '"' + delim; 
+  for (unsigned int i = 0; i < data.size(); i++) {
+    for (size_t j = 0; j < std::size(Model::job); j++) {
+      data_row += '"' + job_value(data[i], j) + '"' + delim; 
+    }
+    for (size_t j = 0; j < std::size(Model::inks); j++) {
+      data_row += '"' + data[i].ink[j] + '"' + delim; 
     }
     data_row = data_row.substr(0, data_row.length()-1);
     data_row += '\n';
@@ -131,3 +97,18 @@ void gen_csv(std::map<std::string, std::vector<std::string>> data, std::string o
     data_row = "";
   } 
 }
+
+// this function takes Model records and generates a csv
+template <class Model>
+void gen_csv(const std::vector<job_record<Model>>& data, std::string out) { 
+  
+  // open ofstream for output
+  std::ofstream ofs(out); 
+  if (!ofs.is_open()) {
+    std::cerr << "gen_csv: Cannot create/open output file <" << out << "> - exiting";
+    return; 
+  }
+  
+  gen_csv_header<Model>(ofs);
+  append_csv<Model>(ofs, data);
+}
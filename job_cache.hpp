@@ -0,0 +1,197 @@
+/*
+ * This is a small in-process cache of recently ingested jobs used
+ * by the parser to decide whether a block has already been put in
+ * the database without having to ask the database every time.
+ *
+ * Jobs are identified by (printer, JobID, Time Started). The keys
+ * of the last CACHE_CAPACITY jobs are kept exactly, and every key
+ * we have seen is also added to a bloom filter. A block is then
+ * checked like so:
+ * 1. not in the bloom filter -> definitely new
+ * 2. in the exact cache -> definitely already ingested
+ * 3. otherwise (evicted or a false positive) -> ask the db
+ *
+ * The cache is warmed from the db with the jobs started in the
+ * last CACHE_DAYS days before this printer's latest job, or with
+ * the newest CACHE_CAPACITY of them if there are more than that.
+ * Jobs started before that window are assumed to be ingested
+ * already.
+ *
+ */
+
+#pragma once
+
+/* Inclusions */
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_set>
+#include <functional>
+#include <iostream>
+#include <sqlite3.h>
+#include "sql_statement.hpp"
+
+// number of job keys kept exactly before the oldest is evicted
+const unsigned int CACHE_CAPACITY = 1 << 16;
+// size of the bloom filter in bits, and the hashes used per key.
+// 16 bits per cached key with 7 hashes gives ~0.05% false positives
+const unsigned int BLOOM_BITS = CACHE_CAPACITY * 16;
+const unsigned int BLOOM_HASHES = 7;
+
+// how many days back from the latest job the cache is warmed with
+int CACHE_DAYS = 7;
+// table the printer's jobs are stored in (its model's table)
+std::string JOB_TABLE = "print_job";
+// jobs started at or before this are outside the cache window. until
+// the cache has been warmed this sorts after any timestamp, which
+// leaves the parser with only its plain latest time comparison
+std::string CACHE_FROM = "~";
+bool CACHE_WARM = false;
+
+// the bloom filter and the number of keys added to it since warming
+std::vector<bool> BLOOM(BLOOM_BITS);
+unsigned int BLOOM_COUNT = 0;
+// the exact cache and its insertion order for eviction
+std::unordered_set<std::string> RECENT_JOBS;
+std::deque<std::string> RECENT_ORDER;
+// connection used to warm the cache and for fall through checks
+sqlite3* CACHE_DB = NULL;
+// how many lookups had to fall through to the db
+unsigned int CACHE_DB_CHECKS = 0;
+
+// builds the cache key for a job
+std::string job_key(const std::string& printer, const std::string& job_id, const std::string& time_started) {
+  return printer + '\x1f' + job_id + '\x1f' + time_started;
+}
+
+// returns the i'th bloom filter bit for key using double hashing
+unsigned int bloom_bit(size_t h, unsigned int i) {
+  size_t h2 = ((h >> 17) | (h << 47)) | 1;
+  return (h + i * h2) % BLOOM_BITS;
+}
+
+// adds key to the bloom filter and the exact cache
+void remember_job(const std::string& key) {
+  size_t h = std::hash<std::string>()(key);
+  for (unsigned int i = 0; i < BLOOM_HASHES; i++) {
+    BLOOM[bloom_bit(h, i)] = true;
+  }
+  BLOOM_COUNT++;
+  if (RECENT_JOBS.insert(key).second) {
+    RECENT_ORDER.push_back(key);
+    // evict the oldest key once we are over capacity
+    if (RECENT_ORDER.size() > CACHE_CAPACITY) {
+      RECENT_JOBS.erase(RECENT_ORDER.front());
+      RECENT_ORDER.pop_front();
+    }
+  }
+}
+
+// returns true if the job is already in JOB_TABLE
+bool job_in_db(const std::string& printer, const std::string& job_id, const std::string& time_started) {
+  CACHE_DB_CHECKS++;
+  int found = 0;
+  sql_statement lookup_job = {"SELECT COUNT(*) FROM " + JOB_TABLE + " j " \
+        "JOIN printer p ON p.id = j.printer_id " \
+        "WHERE p.name = ? AND j.time_started = ? AND j.job_id = ?;",
+        {printer, time_started, job_id}};
+  if (!run_statement(CACHE_DB, lookup_job, [&found](sqlite3_stmt* row) { found = sqlite3_column_int(row, 0); })) {
+    std::cerr << "SQLITE3: cannot execute job lookup <" << sqlite3_errmsg(CACHE_DB) << '>' << std::endl;
+  }
+  return found > 0;
+}
+
+// returns true if the job has already been ingested
+bool job_seen(const std::string& printer, const std::string& job_id, const std::string& time_started) {
+  std::string key = job_key(printer, job_id, time_started);
+  size_t h = std::hash<std::string>()(key);
+  for (unsigned int i = 0; i < BLOOM_HASHES; i++) {
+    if (!BLOOM[bloom_bit(h, i)]) {
+      // never seen, no need to look any further
+      return false;
+    }
+  }
+  if (RECENT_JOBS.count(key)) {
+    return true;
+  }
+  // either evicted or a false positive, only the db knows for sure
+  return job_in_db(printer, job_id, time_started);
+}
+
+// returns true if the cache needs to be (re)warmed, either because
+// it never was or because the bloom filter is getting too full
+bool job_cache_stale() {
+  return !CACHE_WARM || BLOOM_COUNT > CACHE_CAPACITY;
+}
+
+// clears the cache and fills it with printer's jobs from the last
+// CACHE_DAYS days, returns false if the db could not be queried
+bool warm_job_cache(const std::string& printer) {
+  if (CACHE_DB == NULL) {
+    int rc = sqlite3_open("sdc_printer.db", &CACHE_DB);
+    if (rc) {
+      std::cerr << "SQLITE3: cannot open database <" << sqlite3_errmsg(CACHE_DB) << '>' << std::endl;
+      sqlite3_close(CACHE_DB);
+      CACHE_DB = NULL;
+      return false;
+    }
+    sqlite3_busy_timeout(CACHE_DB, BUSY_TIMEOUT_MS);
+  }
+
+  // start over from an empty cache
+  BLOOM.assign(BLOOM_BITS, false);
+  BLOOM_COUNT = 0;
+  RECENT_JOBS.clear();
+  RECENT_ORDER.clear();
+  CACHE_FROM = "~";
+  CACHE_WARM = false;
+  std::string from = "0";
+
+  // find the start of the window, NULL if this printer has no jobs yet
+  sql_statement window = {"SELECT datetime(MAX(j.time_started), ?) " \
+        "FROM " + JOB_TABLE + " j JOIN printer p ON p.id = j.printer_id " \
+        "WHERE p.name = ?;",
+        {"-" + std::to_string(CACHE_DAYS) + " days", printer}};
+  auto from_row = [&from](sqlite3_stmt* row) {
+    if (sqlite3_column_type(row, 0) != SQLITE_NULL) {
+      from = column_text(row, 0);
+    }
+  };
+  if (!run_statement(CACHE_DB, window, from_row)) {
+    std::cerr << "SQLITE3: cannot execute cache window query <" << sqlite3_errmsg(CACHE_DB) << '>' << std::endl;
+    return false;
+  }
+
+  // the bloom filter is only sized for CACHE_CAPACITY keys. if the
+  // window holds more jobs than that it is narrowed down to start at
+  // the newest job that does not fit, anything at or before it is
+  // then treated like a job from before the window
+  sql_statement capacity = {"SELECT j.time_started FROM " + JOB_TABLE + " j " \
+        "JOIN printer p ON p.id = j.printer_id " \
+        "WHERE p.name = ? AND j.time_started > ? " \
+        "ORDER BY j.time_started DESC LIMIT 1 OFFSET " + std::to_string(CACHE_CAPACITY) + ";",
+        {printer, from}};
+  if (!run_statement(CACHE_DB, capacity, from_row)) {
+    std::cerr << "SQLITE3: cannot execute cache capacity query <" << sqlite3_errmsg(CACHE_DB) << '>' << std::endl;
+    return false;
+  }
+
+  // now load every job in the window, this is served by the
+  // <JOB_TABLE>_recent index on (printer_id, time_started, job_id)
+  sql_statement jobs = {"SELECT p.name, j.job_id, j.time_started FROM " + JOB_TABLE + " j " \
+        "JOIN printer p ON p.id = j.printer_id " \
+        "WHERE p.name = ? AND j.time_started > ? " \
+        "ORDER BY j.time_started;",
+        {printer, from}};
+  auto key_row = [](sqlite3_stmt* row) {
+    remember_job(job_key(column_text(row, 0), column_text(row, 1), column_text(row, 2)));
+  };
+  if (!run_statement(CACHE_DB, jobs, key_row)) {
+    std::cerr << "SQLITE3: cannot execute cache warm query <" << sqlite3_errmsg(CACHE_DB) << '>' << std::endl;
+    return false;
+  }
+  CACHE_FROM = from;
+  CACHE_WARM = true;
+  std::cout << "warm_job_cache(): cached " << RECENT_JOBS.size() << " jobs started after <" << CACHE_FROM << '>' << std::endl;
+  return true;
+}
@@ -0,0 +1,198 @@
+/*
+ * This is the filter deciding which job blocks are ingested at all.
+ * It is checked against the job line before anything is copied out
+ * of it, so a rejected block costs a few label searches and nothing
+ * more.
+ *
+ * A filter is a list of predicates separated by ';', all of which
+ * must hold for a block to be ingested. A predicate is
+ *
+ *   <column><op><value>
+ *
+ * where column is any column of the model's job line (see schema.hpp)
+ * and op is one of
+ *   =  !=       equal, not equal
+ *   ^= !^=      starts with, does not start with
+ *   <  <=  >  >=  compared as text, which is right for timestamps
+ *
+ * e.g. skip test prints, cancelled jobs and one media in january:
+ *
+ *   job_name!^=Test Check Jets;canceled=0;media_name!=5x10;
+ *   time_started>=2016-01-01;time_started<2016-02-01
+ *
+ * Values run up to the next ';' and may contain spaces. The text is
+ * compiled once per run into the labels to search for, an empty
+ * filter lets every block through.
+ *
+ */
+
+#pragma once
+
+/* Inclusions */
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <iostream>
+#include <cstring>
+#include "schema.hpp"
+
+// filter applied to every job line, by default test prints are skipped
+std::string FILTER = "job_name!^=Test Check Jets";
+
+enum filter_op {
+  EQUAL,
+  NOT_EQUAL,
+  PREFIX,
+  NOT_PREFIX,
+  LESS,
+  LESS_EQUAL,
+  GREATER,
+  GREATER_EQUAL
+};
+
+// one compiled predicate, the value sits between label and next
+// (the following field's label) or runs to the end of the line
+struct filter_predicate {
+  size_t field;
+  const char* label;
+  size_t label_length;
+  const char* next;
+  size_t next_length;
+  filter_op op;
+  std::string value;
+};
+
+// predicates sorted by field, so the line is searched front to back once
+struct job_filter {
+  std::vector<filter_predicate> predicates;
+};
+
+// the compiled FILTER
+job_filter JOB_FILTER;
+
+// the operators, longest first so "!^=" is not read as "!" + "^="
+const std::pair<const char*, filter_op> FILTER_OPS[] = {
+  {"!^=", NOT_PREFIX},
+  {"^=",  PREFIX},
+  {"!=",  NOT_EQUAL},
+  {"<=",  LESS_EQUAL},
+  {">=",  GREATER_EQUAL},
+  {"=",   EQUAL},
+  {"<",   LESS},
+  {">",   GREATER}};
+
+// strips spaces from both ends of s
+std::string trim(const std::string& s) {
+  size_t start = s.find_first_not_of(' ');
+  if (start == std::string::npos) {
+    return "";
+  }
+  return s.substr(start, s.find_last_not_of(' ') - start + 1);
+}
+
+// compiles text into filter for Model's job line,
+// returns false (and says why) if text does not make sense
+template <class Model>
+bool compile_filter(const std::string& text, job_filter& filter) {
+  constexpr size_t N = std::size(Model::job);
+  filter.predicates.clear();
+  size_t pos = 0;
+  while (pos <= text.size()) {
+    size_t end = text.find(';', pos);
+    if (end == std::string::npos) {
+      end = text.size();
+    }
+    std::string term = trim(text.substr(pos, end - pos));
+    pos = end + 1;
+    if (term.empty()) {
+      continue;
+    }
+    // the column is everything up to the operator
+    size_t op_at = term.find_first_of("!^<>=");
+    if (op_at == std::string::npos || op_at == 0) {
+      std::cerr << "compile_filter(): no column and operator in <" << term << '>' << std::endl;
+      return false;
+    }
+    std::string column = trim(term.substr(0, op_at));
+    size_t field = N;
+    for (size_t i = 0; i < N; i++) {
+      if (column == Model::job[i].column) {
+        field = i;
+      }
+    }
+    if (field == N) {
+      std::cerr << "compile_filter(): no column <" << column << "> in model <" << Model::name << '>' << std::endl;
+      return false;
+    }
+    filter_predicate p;
+    p.field = field;
+    p.label = Model::job[field].label;
+    p.label_length = strlen(p.label);
+    p.next = field + 1 < N ? Model::job[field + 1].label : NULL;
+    p.next_length = p.next ? strlen(p.next) : 0;
+    size_t op_length = 0;
+    for (const auto& op : FILTER_OPS) {
+      if (term.compare(op_at, strlen(op.first), op.first) == 0) {
+        p.op = op.second;
+        op_length = strlen(op.first);
+        break;
+      }
+    }
+    if (op_length == 0) {
+      std::cerr << "compile_filter(): unknown operator in <" << term << '>' << std::endl;
+      return false;
+    }
+    p.value = trim(term.substr(op_at + op_length));
+    filter.predicates.push_back(p);
+  }
+  std::stable_sort(filter.predicates.begin(), filter.predicates.end(),
+      [](const filter_predicate& a, const filter_predicate& b) { return a.field < b.field; });
+  return true;
+}
+
+// returns true if predicate p holds for value v
+bool predicate_holds(const filter_predicate& p, std::string_view v) {
+  switch (p.op) {
+    case EQUAL:         return v == p.value;
+    case NOT_EQUAL:     return v != p.value;
+    case PREFIX:        return v.substr(0, p.value.size()) == p.value;
+    case NOT_PREFIX:    return v.substr(0, p.value.size()) != p.value;
+    case LESS:          return v < p.value;
+    case LESS_EQUAL:    return v <= p.value;
+    case GREATER:       return v > p.value;
+    case GREATER_EQUAL: return v >= p.value;
+  }
+  return false;
+}
+
+// returns true if the job line passes every predicate of filter.
+// values are looked at in place, nothing is copied out of line
+bool filter_accepts(const job_filter& filter, const std::string& line) {
+  std::string_view bytes(line);
+  size_t pos = 0;
+  for (const filter_predicate& p : filter.predicates) {
+    size_t start = bytes.find(std::string_view(p.label, p.label_length), pos);
+    if (start == std::string_view::npos) {
+      // not a job line we understand, let the parser report it
+      return true;
+    }
+    start += p.label_length;
+    size_t end = bytes.size();
+    if (p.next != NULL) {
+      end = bytes.find(std::string_view(p.next, p.next_length), start);
+      if (end == std::string_view::npos) {
+        return true;
+      }
+      // -1 for the space in front of the next label
+      end = end > start ? end - 1 : start;
+    }
+    if (!predicate_holds(p, bytes.substr(start, end - start))) {
+      return false;
+    }
+    // predicates on the same field start from the same place
+    pos = start - p.label_length;
+  }
+  return true;
+}
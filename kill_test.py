@@ -0,0 +1,176 @@
+#!/usr/bin/env python3
+#
+# Kill-at-random test of crash-consistent ingest.
+#
+# Writes a synthetic printer log in random slices (cutting lines and
+# blocks anywhere, rotating it part way through) while killtest.o is
+# started on it and SIGKILLed at random points, over and over. Then
+# checks that every job ended up in print_job exactly once, in log
+# order, with the values the log has for it.
+#
+# The rotation either renames the live log, or copies it and truncates
+# it in place (logrotate's copytruncate), after which the same file
+# grows past the old checkpoint before ingest runs on it again.
+#
+# killtest.o is db.o built without the job cache and timestamp checks
+# (make killtest.o), so only the checkpoint in ingest_state stands
+# between a kill and a duplicated or lost job.
+#
+# Usage: ./kill_test.py [kills] [seed]
+#
+
+import os
+import random
+import shutil
+import signal
+import sqlite3
+import subprocess
+import sys
+import tempfile
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+BINARY = os.path.join(HERE, "killtest.o")
+BLOCKS = 3000
+INKS = ["C", "M", "Y", "K", "c", "m", "y", "k", "W"]
+MEDIA = ["5x10", "4x8 Coroplast", "Vinyl 54"]
+
+
+def make_log(rng):
+    """returns the log text and the (job id, name, w ink) of every job that should be stored"""
+    lines = []
+    jobs = []
+    for i in range(1, BLOCKS + 1):
+        lines.append("2016-01-04 16:%02d:%02d jdfserverd: some other line" % (i // 60 % 60, i % 60))
+        test = rng.random() < 0.05
+        name = "Test Check Jets" if test else rng.choice(["job_%d.rtl", "Bob's_Fish_%d.rtl", "a b c %d.rtl"]) % i
+        started = "2016-01-%02d %02d:%02d:%02d" % (4 + i // 2000, i // 3600 % 24, i // 60 % 60, i % 60)
+        inks = ["%.6f" % rng.uniform(0.001, 0.02) for _ in INKS]
+        lines.append("2016-01-04 16:00:00 jdfserverd: Job Complete Data:")
+        lines.append(" JobID: %d Job Name: %s Print Function: 1 Copies Printed: 1 Total Copies: 1 "
+                     "Completed: 1 Canceled: 0 DoubleSided: 0 Time Started: %s Time Duration: 591 "
+                     "Time Units: Seconds Image Width: 115.627 Image Length: 59.5167 Media Length: 59.5167 "
+                     "Prints Per Job: 1 Media Name: %s Media IntegrationId: 0 Media Type: Sheet "
+                     "Media Width: 120 Media Height: 60 Media Grade: 0.01 Media Offset: 0 Media Units: Sqft "
+                     "Media Printed: 47.7897" % (i, name, started, rng.choice(MEDIA)))
+        lines.append("Total Ink Usage:")
+        for ink, value in zip(INKS, inks):
+            lines.append("Ink Name: %s Ink Consumption: %s Ink Units: mL" % (ink, value))
+        if not test:
+            jobs.append((str(i), name, inks[-1]))
+    return ("\n".join(lines) + "\n").encode(), jobs
+
+
+def stored_jobs(db):
+    if not os.path.exists(db):
+        return []
+    conn = sqlite3.connect(db)
+    try:
+        return conn.execute("SELECT job_id, job_name, w_ink FROM print_job ORDER BY id").fetchall()
+    except sqlite3.OperationalError:
+        return []
+    finally:
+        conn.close()
+
+
+def start(logs, rng):
+    args = [BINARY, logs, "A", "7", str(rng.choice([1, 7, 50, 500])), str(rng.choice([5, 50, 1000])),
+            rng.choice(["off", "normal", "full"]), str(rng.choice([1, 16, 4096]))]
+    return subprocess.Popen(args, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+
+
+def catch_up(logs, rng, count):
+    """runs killtest.o until it has stored count jobs"""
+    p = start(logs, rng)
+    deadline = time.time() + 60
+    while len(stored_jobs("sdc_printer.db")) < count and time.time() < deadline:
+        time.sleep(0.1)
+    p.send_signal(signal.SIGKILL)
+    p.wait()
+
+
+def main():
+    kills = int(sys.argv[1]) if len(sys.argv) > 1 else 100
+    seed = int(sys.argv[2]) if len(sys.argv) > 2 else int(time.time())
+    rng = random.Random(seed)
+    # make knows when the binary is older than the source
+    subprocess.check_call(["make", "-C", HERE, "killtest.o"])
+    data, jobs = make_log(rng)
+
+    work = tempfile.mkdtemp(prefix="kill_test_")
+    os.chdir(work)
+    live = "jdfserverd.log"
+    archive = "jdfserverd.log.1"
+    logs = archive + "," + live
+    copytruncate = rng.random() < 0.5
+    # rotation happens between lines, like logrotate does
+    rotate_at = data.index(b"\n", rng.randrange(len(data) // 4, len(data) // 2)) + 1
+    if copytruncate:
+        # lines written after the last pass and before the copy only end
+        # up in the copy, which nothing can tell from the rewritten file.
+        # so the copy is made once ingest has caught up, which it can at
+        # the start of a job block (the block before it is complete)
+        rotate_at = data.rindex(b"\n", 0, data.index(b"Job Complete Data:", rotate_at)) + 1
+    written = 0
+    out = open(live, "wb")
+
+    for kill in range(kills):
+        # grow the log by a random slice, it will usually end mid line
+        if written < len(data):
+            end = min(len(data), written + rng.randint(1, 2 * len(data) // kills + 1))
+            if written < rotate_at <= end:
+                out.write(data[written:rotate_at])
+                if copytruncate:
+                    out.flush()
+                    next_job = int(data[rotate_at:].split(b"JobID: ", 1)[1].split(b" ", 1)[0])
+                    catch_up(logs, rng, len([j for j in jobs if int(j[0]) < next_job]))
+                    shutil.copyfile(live, archive)
+                    out.seek(0)
+                    out.truncate()
+                    # the same file grows past the old checkpoint
+                    # before ingest gets to look at it again
+                    end = max(end, min(len(data), 2 * rotate_at))
+                else:
+                    out.close()
+                    os.rename(live, archive)
+                    out = open(live, "wb")
+                written = rotate_at
+            out.write(data[written:end])
+            out.flush()
+            written = end
+        p = start(logs, rng)
+        time.sleep(rng.uniform(0.0, 0.3))
+        p.send_signal(signal.SIGKILL)
+        p.wait()
+    out.write(data[written:])
+    out.close()
+
+    # one last run, left alone until it has caught up with the log
+    p = start(logs, rng)
+    deadline = time.time() + 60
+    while len(stored_jobs("sdc_printer.db")) < len(jobs) and time.time() < deadline:
+        time.sleep(0.5)
+    time.sleep(2)
+    p.send_signal(signal.SIGKILL)
+    p.wait()
+
+    stored = stored_jobs("sdc_printer.db")
+    expected = [tuple(j) for j in jobs]
+    ok = stored == expected
+    print("kill_test: seed %d, %d kills, %s, %d of %d jobs stored, %s (in %s)"
+          % (seed, kills, "copytruncate" if copytruncate else "rename", len(stored), len(expected),
+             "OK" if ok else "FAILED", work))
+    if not ok:
+        seen = set()
+        dups = [s[0] for s in stored if s[0] in seen or seen.add(s[0])]
+        missing = sorted(set(j[0] for j in expected) - set(s[0] for s in stored), key=int)
+        wrong = [s for s in stored if s not in expected]
+        print("kill_test: duplicated %s" % dups[:10])
+        print("kill_test: missing %s" % missing[:10])
+        print("kill_test: wrong values %s" % wrong[:10])
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,540 @@
+/*
+ * This is the reader the parser pulls log lines from. It reads one
+ * or more files (rotated archives first, then the live log) as a
+ * single stream of lines, in large READ_SIZE reads.
+ *
+ * With USE_URING set and a kernel that supports io_uring, up to
+ * READ_DEPTH reads are kept in flight at once, across files, into
+ * buffers registered with the kernel, so the disk keeps working while
+ * we are busy parsing. The ring is set up straight through the kernel
+ * interface, which is all liburing wraps. Otherwise (the default, an
+ * old kernel, seccomp, ...) the same buffers are filled with plain
+ * pread().
+ *
+ * Usage is much like an ifstream:
+ *
+ *   log_reader reader;
+ *   open_logs(reader, paths);
+ *   while (read_line(reader, line)) { ... }
+ *   close_logs(reader);
+ *
+ * The reader also keeps track of where in the log the last complete
+ * line ended (log_at), and can be opened at such a position again to
+ * carry on exactly where an earlier run stopped. Files are identified
+ * there by device and inode rather than by path, so a position still
+ * points at the right file after log rotation has renamed it. A
+ * position kept for later (log_checkpoint) also carries a hash of the
+ * bytes just before it, so a file that was truncated and written
+ * again in place (copytruncate) is read from its start instead of
+ * from the middle of its new contents.
+ *
+ */
+
+#pragma once
+
+/* Inclusions */
+#include <string>
+#include <vector>
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define SDC_IO_URING 1
+#endif
+
+// size of each read and the number of reads kept in flight
+const size_t READ_SIZE = 1 << 20;
+const unsigned int READ_DEPTH = 8;
+// set to true to read through io_uring where the kernel has it. off
+// by default, it has not been measured faster yet (see bench_reader.cpp)
+bool USE_URING = false;
+// how many bytes before a position its fingerprint is taken of
+const off_t FINGERPRINT_BYTES = 256;
+
+// one read, either in flight or waiting to be parsed
+struct read_slot {
+  int file;       // index into log_reader::fds
+  off_t offset;   // where in the file the read starts
+  size_t length;  // how much we asked for
+  bool last;      // whether it runs to the end of the file
+  bool done;      // whether the read has completed
+};
+
+// a place in the log, just after a complete line. segment is the
+// file's "<device>:<inode>", an empty segment is the very beginning.
+// fingerprint is only filled in by log_checkpoint
+struct log_position {
+  std::string segment;
+  off_t offset = 0;
+  std::string fingerprint;
+};
+
+// the kernel side of io_uring, all of it mapped into our memory
+struct uring {
+  int fd = -1;
+  bool registered = false;
+  unsigned* sq_tail;
+  unsigned* sq_mask;
+  unsigned* sq_array;
+  unsigned* cq_head;
+  unsigned* cq_tail;
+  unsigned* cq_mask;
+  void* sq_ring;
+  size_t sq_ring_size;
+  void* cq_ring;
+  size_t cq_ring_size;
+  size_t sqes_size;
+#ifdef SDC_IO_URING
+  io_uring_sqe* sqes;
+  io_uring_cqe* cqes;
+#endif
+};
+
+struct log_reader {
+  std::vector<std::string> paths;
+  std::vector<int> fds;
+  std::vector<off_t> sizes;
+  std::vector<std::string> segments;
+  // READ_DEPTH buffers of READ_SIZE bytes in one allocation
+  char* buffers = NULL;
+  read_slot slots[READ_DEPTH];
+  // slots in use, oldest first, as a ring of head/count
+  unsigned int head = 0;
+  unsigned int count = 0;
+  // next file and offset that still has to be read
+  int next_file = 0;
+  off_t next_offset = 0;
+  // what is left of the buffer at head, once it is being parsed
+  const char* cur = NULL;
+  const char* end = NULL;
+  // part of a line that ran past the end of the last buffer
+  std::string partial;
+  // a line handed back with unread_line(), returned again next
+  std::string unread;
+  bool has_unread = false;
+  // where the last complete line ended, where the one before it ended
+  // (for unread_line) and where the unread line ends
+  int at_file = 0;
+  off_t at_offset = 0;
+  int before_file = 0;
+  off_t before_offset = 0;
+  int unread_file = 0;
+  off_t unread_offset = 0;
+  uring ring;
+};
+
+#ifdef SDC_IO_URING
+
+// sets up the ring and registers the buffers, returns false if
+// io_uring is not available so the caller can fall back to pread
+bool uring_open(log_reader& r) {
+  io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  int fd = syscall(__NR_io_uring_setup, READ_DEPTH, &p);
+  if (fd < 0) {
+    return false;
+  }
+  uring& u = r.ring;
+  u.fd = fd;
+  u.sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  u.cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+  u.sq_ring = mmap(0, u.sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  u.cq_ring = mmap(0, u.cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+  u.sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+  u.sqes = static_cast<io_uring_sqe*>(mmap(0, u.sqes_size,
+      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+  if (u.sq_ring == MAP_FAILED || u.cq_ring == MAP_FAILED || u.sqes == MAP_FAILED) {
+    close(fd);
+    u.fd = -1;
+    return false;
+  }
+  char* sq = static_cast<char*>(u.sq_ring);
+  char* cq = static_cast<char*>(u.cq_ring);
+  u.sq_tail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+  u.sq_mask = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+  u.sq_array = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+  u.cq_head = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+  u.cq_tail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+  u.cq_mask = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+  u.cqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+
+  // register the buffers so the kernel does not have to map them for every read
+  iovec iov[READ_DEPTH];
+  for (unsigned int i = 0; i < READ_DEPTH; i++) {
+    iov[i].iov_base = r.buffers + i * READ_SIZE;
+    iov[i].iov_len = READ_SIZE;
+  }
+  u.registered = syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, iov, READ_DEPTH) == 0;
+  if (!u.registered) {
+    std::cerr << "log_reader: cannot register buffers, using unregistered reads" << std::endl;
+  }
+  return true;
+}
+
+// queues a read of slot i and hands it to the kernel
+void uring_submit(log_reader& r, unsigned int i) {
+  uring& u = r.ring;
+  unsigned tail = *u.sq_tail;
+  unsigned index = tail & *u.sq_mask;
+  io_uring_sqe* sqe = &u.sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = u.registered ? IORING_OP_READ_FIXED : IORING_OP_READ;
+  sqe->fd = r.fds[r.slots[i].file];
+  sqe->off = r.slots[i].offset;
+  sqe->addr = reinterpret_cast<unsigned long>(r.buffers + i * READ_SIZE);
+  sqe->len = r.slots[i].length;
+  sqe->buf_index = i;
+  sqe->user_data = i;
+  u.sq_array[index] = index;
+  __atomic_store_n(u.sq_tail, tail + 1, __ATOMIC_RELEASE);
+  long ret;
+  do {
+    ret = syscall(__NR_io_uring_enter, u.fd, 1, 0, 0, NULL, 0);
+  } while (ret < 0 && errno == EINTR);
+  if (ret != 1) {
+    // the kernel did not take the read (EAGAIN, EBUSY, ...), so no
+    // completion will ever come for it. the kernel only looks at the
+    // ring inside io_uring_enter, so we can take it back out and mark
+    // it done with nothing read, next_buffer then preads all of it
+    __atomic_store_n(u.sq_tail, tail, __ATOMIC_RELEASE);
+    r.slots[i].length = 0;
+    r.slots[i].done = true;
+  }
+}
+
+// waits until slot i has completed, marking any others that finish first
+void uring_wait(log_reader& r, unsigned int i) {
+  uring& u = r.ring;
+  while (!r.slots[i].done) {
+    unsigned head = *u.cq_head;
+    unsigned tail = __atomic_load_n(u.cq_tail, __ATOMIC_ACQUIRE);
+    if (head == tail) {
+      syscall(__NR_io_uring_enter, u.fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+      continue;
+    }
+    for (; head != tail; head++) {
+      io_uring_cqe* cqe = &u.cqes[head & *u.cq_mask];
+      read_slot& s = r.slots[cqe->user_data];
+      if (cqe->res < 0) {
+        // the kernel could not do this read, redo it with pread
+        s.length = 0;
+      } else {
+        s.length = cqe->res;
+      }
+      s.done = true;
+    }
+    __atomic_store_n(u.cq_head, head, __ATOMIC_RELEASE);
+  }
+}
+
+void uring_close(log_reader& r) {
+  uring& u = r.ring;
+  if (u.fd < 0) {
+    return;
+  }
+  munmap(u.sqes, u.sqes_size);
+  munmap(u.sq_ring, u.sq_ring_size);
+  munmap(u.cq_ring, u.cq_ring_size);
+  close(u.fd);
+  u.fd = -1;
+}
+
+#else
+
+bool uring_open(log_reader& r) { return false; }
+void uring_submit(log_reader& r, unsigned int i) {}
+void uring_wait(log_reader& r, unsigned int i) {}
+void uring_close(log_reader& r) {}
+
+#endif
+
+// returns true if reads are going through io_uring
+bool using_uring(const log_reader& r) {
+  return r.ring.fd >= 0;
+}
+
+// starts reads into every free slot until READ_DEPTH are in flight
+void fill_slots(log_reader& r) {
+  while (r.count < READ_DEPTH && r.next_file < (int) r.fds.size()) {
+    // skip past files we have read all of
+    if (r.next_offset >= r.sizes[r.next_file]) {
+      r.next_file++;
+      r.next_offset = 0;
+      continue;
+    }
+    unsigned int i = (r.head + r.count) % READ_DEPTH;
+    read_slot& s = r.slots[i];
+    s.file = r.next_file;
+    s.offset = r.next_offset;
+    s.length = std::min<off_t>(READ_SIZE, r.sizes[r.next_file] - r.next_offset);
+    s.done = false;
+    r.next_offset += s.length;
+    s.last = r.next_offset >= r.sizes[r.next_file];
+    r.count++;
+    if (using_uring(r)) {
+      uring_submit(r, i);
+    }
+  }
+}
+
+// waits for the oldest read to finish and makes it the current buffer,
+// returns false once there is nothing left to read
+bool next_buffer(log_reader& r) {
+  if (r.count == 0) {
+    return false;
+  }
+  read_slot& s = r.slots[r.head];
+  char* buf = r.buffers + r.head * READ_SIZE;
+  size_t wanted = std::min<off_t>(READ_SIZE, r.sizes[s.file] - s.offset);
+  if (using_uring(r)) {
+    uring_wait(r, r.head);
+  } else {
+    s.length = 0;
+  }
+  // pread whatever the ring did not give us (or all of it, without a ring)
+  while (s.length < wanted) {
+    ssize_t n = pread(r.fds[s.file], buf + s.length, wanted - s.length, s.offset + s.length);
+    if (n <= 0) {
+      break;
+    }
+    s.length += n;
+  }
+  r.cur = buf;
+  r.end = buf + s.length;
+  return true;
+}
+
+// releases the current buffer so its slot can be read into again
+void release_buffer(log_reader& r) {
+  r.head = (r.head + 1) % READ_DEPTH;
+  r.count--;
+  r.cur = r.end = NULL;
+  fill_slots(r);
+}
+
+// returns the segment id of the file st was taken of
+std::string segment_id(const struct stat& st) {
+  return std::to_string(st.st_dev) + ':' + std::to_string(st.st_ino);
+}
+
+// returns a hash (64 bit FNV-1a) of the FINGERPRINT_BYTES of file
+// that come before offset, or "" if they cannot be read
+std::string fingerprint(const log_reader& r, int file, off_t offset) {
+  off_t start = std::max<off_t>(0, offset - FINGERPRINT_BYTES);
+  char buf[FINGERPRINT_BYTES];
+  size_t length = offset - start;
+  size_t got = 0;
+  while (got < length) {
+    ssize_t n = pread(r.fds[file], buf + got, length - got, start + got);
+    if (n <= 0) {
+      return "";
+    }
+    got += n;
+  }
+  unsigned long long hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < length; i++) {
+    hash = (hash ^ static_cast<unsigned char>(buf[i])) * 1099511628211ULL;
+  }
+  return std::to_string(hash);
+}
+
+// opens every file in paths and starts the first reads, from position
+// from if it is given and still in one of the files. files that cannot
+// be opened are reported and skipped
+bool open_logs(log_reader& r, const std::vector<std::string>& paths, const log_position& from = log_position()) {
+  r.paths = paths;
+  for (unsigned int i = 0; i < paths.size(); i++) {
+    int fd = open(paths[i].c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+      std::cerr << "log_reader: cannot open log file <" << paths[i] << '>' << std::endl;
+      if (fd >= 0) {
+        close(fd);
+      }
+      continue;
+    }
+    r.fds.push_back(fd);
+    r.sizes.push_back(st.st_size);
+    r.segments.push_back(segment_id(st));
+  }
+  if (r.fds.empty()) {
+    return false;
+  }
+  // skip everything before from. if its file is gone (rotated out of
+  // paths), has shrunk or has different bytes before from (truncated,
+  // and maybe written past from again) we cannot trust it and read it all
+  if (!from.segment.empty()) {
+    int file = -1;
+    for (unsigned int i = 0; i < r.segments.size(); i++) {
+      if (r.segments[i] == from.segment) {
+        file = i;
+      }
+    }
+    if (file == -1) {
+      std::cout << "log_reader: segment <" << from.segment << "> not in log files, reading all of them" << std::endl;
+    } else if (from.offset > r.sizes[file]) {
+      std::cout << "log_reader: segment <" << from.segment << "> shrank below " << from.offset
+                << ", reading it from the start" << std::endl;
+      r.next_file = file;
+    } else if (from.fingerprint.empty() || fingerprint(r, file, from.offset) != from.fingerprint) {
+      std::cout << "log_reader: segment <" << from.segment << "> was rewritten before " << from.offset
+                << ", reading it from the start" << std::endl;
+      r.next_file = file;
+    } else {
+      r.next_file = file;
+      r.next_offset = from.offset;
+    }
+    r.at_file = r.before_file = r.next_file;
+    r.at_offset = r.before_offset = r.next_offset;
+  }
+  if (posix_memalign(reinterpret_cast<void**>(&r.buffers), 4096, READ_DEPTH * READ_SIZE)) {
+    r.buffers = NULL;
+    return false;
+  }
+  if (!USE_URING) {
+    std::cout << "log_reader: io_uring turned off, using pread" << std::endl;
+  } else if (!uring_open(r)) {
+    std::cout << "log_reader: io_uring not available, using pread" << std::endl;
+  }
+  fill_slots(r);
+  return true;
+}
+
+// reads the next line into line, without the trailing '\n'.
+// returns false (and an empty line) once every file is done
+bool read_line(log_reader& r, std::string& line) {
+  if (r.has_unread) {
+    line.swap(r.unread);
+    r.has_unread = false;
+    r.before_file = r.at_file;
+    r.before_offset = r.at_offset;
+    r.at_file = r.unread_file;
+    r.at_offset = r.unread_offset;
+    return true;
+  }
+  line.clear();
+  r.before_file = r.at_file;
+  r.before_offset = r.at_offset;
+  while (true) {
+    if (r.cur == NULL && !next_buffer(r)) {
+      return false;
+    }
+    const char* nl = static_cast<const char*>(memchr(r.cur, '\n', r.end - r.cur));
+    if (nl != NULL) {
+      if (r.partial.empty()) {
+        line.assign(r.cur, nl);
+      } else {
+        line.swap(r.partial);
+        line.append(r.cur, nl);
+      }
+      r.cur = nl + 1;
+      const read_slot& s = r.slots[r.head];
+      r.at_file = s.file;
+      r.at_offset = s.offset + (r.cur - (r.buffers + r.head * READ_SIZE));
+      if (r.cur == r.end) {
+        release_buffer(r);
+      }
+      return true;
+    }
+    // no newline left in this buffer, carry the rest over into
+    // the next one. a line never carries over into the next file
+    r.partial.append(r.cur, r.end);
+    const read_slot& s = r.slots[r.head];
+    bool last = s.last;
+    int file = s.file;
+    release_buffer(r);
+    if (last && !r.partial.empty()) {
+      // the last line of the live log without a '\n' may still be
+      // being written, so it does not move the position on. the
+      // files before it (rotated archives) are not written to anymore
+      if (file + 1 < (int) r.fds.size()) {
+        r.at_file = file;
+        r.at_offset = r.sizes[file];
+      }
+      line.swap(r.partial);
+      return true;
+    }
+  }
+}
+
+// hands line back so the next read_line() returns it again,
+// for looking one line ahead
+void unread_line(log_reader& r, const std::string& line) {
+  r.unread = line;
+  r.has_unread = true;
+  r.unread_file = r.at_file;
+  r.unread_offset = r.at_offset;
+  r.at_file = r.before_file;
+  r.at_offset = r.before_offset;
+}
+
+// returns where the last complete line read ended
+log_position log_at(const log_reader& r) {
+  log_position p;
+  p.segment = r.segments[r.at_file];
+  p.offset = r.at_offset;
+  return p;
+}
+
+// returns where the last complete line read ended, fingerprinted so
+// that open_logs can tell whether it still means the same place
+log_position log_checkpoint(const log_reader& r) {
+  log_position p = log_at(r);
+  p.fingerprint = fingerprint(r, r.at_file, p.offset);
+  return p;
+}
+
+// returns true if a and b are the same place in the log
+bool same_position(const log_position& a, const log_position& b) {
+  return a.segment == b.segment && a.offset == b.offset;
+}
+
+// reads the next line like read_line, but returns false if the line
+// is not all there yet (no '\n' so far, it may still be being written)
+bool read_complete_line(log_reader& r, std::string& line) {
+  log_position before = log_at(r);
+  return read_line(r, line) && !same_position(before, log_at(r));
+}
+
+// waits for anything still in flight and frees everything
+void close_logs(log_reader& r) {
+  while (r.count > 0) {
+    if (using_uring(r)) {
+      uring_wait(r, r.head);
+    }
+    r.head = (r.head + 1) % READ_DEPTH;
+    r.count--;
+  }
+  uring_close(r);
+  for (unsigned int i = 0; i < r.fds.size(); i++) {
+    close(r.fds[i]);
+  }
+  r.fds.clear();
+  free(r.buffers);
+  r.buffers = NULL;
+}
+
+// splits a comma separated list of log files into paths
+std::vector<std::string> split_paths(const std::string& list) {
+  std::vector<std::string> paths;
+  size_t start = 0;
+  while (start <= list.size()) {
+    size_t comma = list.find(',', start);
+    if (comma == std::string::npos) {
+      comma = list.size();
+    }
+    if (comma > start) {
+      paths.push_back(list.substr(start, comma - start));
+    }
+    start = comma + 1;
+  }
+  return paths;
+}
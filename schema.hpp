@@ -0,0 +1,494 @@
+/*
+ * This describes the layout of the job blocks each printer model
+ * writes to its log, and generates everything that depends on it
+ * from that one description:
+ * 1. the record a parsed block is stored in (job_record)
+ * 2. the tokenizer for the job line and the ink lines
+ * 3. the sql to create, migrate and insert into its table
+ * 4. the csv header (see csv_parser.hpp)
+ *
+ * A model is a struct with:
+ *   name   - what it is selected by on the command line
+ *   table  - table its jobs are stored in
+ *   view   - view with the old flat layout of that table
+ *   job[]  - fields of the job line, in the order they appear
+ *   inks[] - ink lines after "Total Ink Usage:", in order
+ *
+ * Everything is resolved at compile time, each model gets its own
+ * parser with field positions and kinds baked in. To support a new
+ * printer add its model below and to with_model().
+ *
+ */
+
+#pragma once
+
+/* Inclusions */
+#include <string>
+#include <vector>
+#include <iterator>
+#include <iostream>
+#include "string_intern.hpp"
+#include "log_reader.hpp"
+
+// how a value of the job line is kept
+enum field_kind {
+  TEXT,         // different for every job, kept as text
+  REPEATED,     // repeats across jobs, interned but stored as text
+  MEDIA_NAME,   // the next three are interned and stored
+  MEDIA_TYPE,   // through the media lookup table
+  MEDIA_UNITS
+};
+
+// one value of the job line
+struct job_field {
+  const char* label;   // text in front of the value in the log
+  const char* column;  // name of the db column and csv header
+  field_kind kind;
+};
+
+// one ink line, "Ink Name: <name> Ink Consumption: <value> Ink Units: mL"
+struct ink_field {
+  const char* name;    // the ink name the line must have
+  const char* column;  // name of the db column and csv header
+};
+
+/*
+ * The job line every Vutek we have logged so far writes:
+ *
+ *  JobID: 244 Job Name: 194_2159_Fish_Fin_156_T1_P1_VuteK_8C.rtl Print Function: 1 Copies Printed: 1 Total Copies: 1 Completed: 1 Canceled: 0 DoubleSided: 0 Time Started: 2016-01-04 16:03:58 Time Duration: 591 Time Units: Seconds Image Width: 115.627 Image Length: 59.5167 Media Length: 59.5167 Prints Per Job: 1 Media Name: 5x10 Media IntegrationId: 0 Media Type: Sheet Media Width: 120 Media Height: 60 Media Grade: 0.01 Media Offset: 0 Media Units: Sqft Media Printed: 47.7897
+ */
+inline constexpr job_field VUTEK_JOB[] = {
+  {"JobID: ",                "job_id",              TEXT},
+  {"Job Name: ",             "job_name",            TEXT},
+  {"Print Function: ",       "print_function",      TEXT},
+  {"Copies Printed: ",       "copies_printed",      TEXT},
+  {"Total Copies: ",         "total_copies",        TEXT},
+  {"Completed: ",            "completed",           TEXT},
+  {"Canceled: ",             "canceled",            TEXT},
+  {"DoubleSided: ",          "doublesided",         TEXT},
+  {"Time Started: ",         "time_started",        TEXT},
+  {"Time Duration: ",        "time_duration",       TEXT},
+  {"Time Units: ",           "time_units",          REPEATED},
+  {"Image Width: ",          "image_width",         TEXT},
+  {"Image Length: ",         "image_length",        TEXT},
+  {"Media Length: ",         "media_length",        TEXT},
+  {"Prints Per Job: ",       "prints_per_job",      TEXT},
+  {"Media Name: ",           "media_name",          MEDIA_NAME},
+  {"Media IntegrationId: ",  "media_integrationid", TEXT},
+  {"Media Type: ",           "type",                MEDIA_TYPE},
+  {"Media Width: ",          "media_width",         TEXT},
+  {"Media Height: ",         "media_height",        TEXT},
+  {"Media Grade: ",          "media_grade",         TEXT},
+  {"Media Offset: ",         "media_offset",        TEXT},
+  {"Media Units: ",          "media_units",         MEDIA_UNITS},
+  {"Media Printed: ",        "sqft_media_printed",  TEXT}};
+
+// 8 colours (CMYK and light CMYK) + white
+struct vutek_8c {
+  static constexpr const char* name = "vutek_8c";
+  static constexpr const char* table = "print_job";
+  static constexpr const char* view = "print_jobs";
+  static constexpr auto& job = VUTEK_JOB;
+  static constexpr ink_field inks[] = {
+    {"C", "c_ink"},
+    {"M", "m_ink"},
+    {"Y", "y_ink"},
+    {"K", "k_ink"},
+    {"c", "lc_ink"},
+    {"m", "lm_ink"},
+    {"y", "ly_ink"},
+    {"k", "lk_ink"},
+    {"W", "w_ink"}};
+};
+
+// 4 colours (CMYK) only
+struct vutek_4c {
+  static constexpr const char* name = "vutek_4c";
+  static constexpr const char* table = "print_job_4c";
+  static constexpr const char* view = "print_jobs_4c";
+  static constexpr auto& job = VUTEK_JOB;
+  static constexpr ink_field inks[] = {
+    {"C", "c_ink"},
+    {"M", "m_ink"},
+    {"Y", "y_ink"},
+    {"K", "k_ink"}};
+};
+
+// calls f with a default constructed model named name,
+// returns false if there is no model by that name
+template <class F>
+bool with_model(const std::string& name, F f) {
+  if (name == vutek_8c::name) {
+    f(vutek_8c());
+  } else if (name == vutek_4c::name) {
+    f(vutek_4c());
+  } else {
+    std::cerr << "with_model(): unknown printer model <" << name << '>' << std::endl;
+    return false;
+  }
+  return true;
+}
+
+//#####################
+// COMPILE TIME LOOKUPS
+//#####################
+
+// strcmp() that can run at compile time
+constexpr bool same(const char* a, const char* b) {
+  return *a == *b && (*a == '\0' || same(a + 1, b + 1));
+}
+
+// strlen() that can run at compile time
+constexpr size_t length(const char* s) {
+  return *s == '\0' ? 0 : 1 + length(s + 1);
+}
+
+// index of the job field with column, or the field count if there is none
+template <class Model>
+constexpr size_t job_column(const char* column) {
+  for (size_t i = 0; i < std::size(Model::job); i++) {
+    if (same(Model::job[i].column, column)) {
+      return i;
+    }
+  }
+  return std::size(Model::job);
+}
+
+// index of the (first) job field of kind, or the field count if there is none
+template <class Model>
+constexpr size_t job_kind(field_kind kind) {
+  for (size_t i = 0; i < std::size(Model::job); i++) {
+    if (Model::job[i].kind == kind) {
+      return i;
+    }
+  }
+  return std::size(Model::job);
+}
+
+//#####################
+// RECORD
+//#####################
+
+// a single parsed block of the log for Model. job values are
+// indexed like Model::job: TEXT values are kept in text, all the
+// others as ids into the STRINGS table in ref. ink values are
+// indexed like Model::inks
+template <class Model>
+struct job_record {
+  static constexpr size_t JOBS = std::size(Model::job);
+  static constexpr size_t INKS = std::size(Model::inks);
+
+  // fields the rest of the program depends on
+  static constexpr size_t JOB_ID = job_column<Model>("job_id");
+  static constexpr size_t JOB_NAME = job_column<Model>("job_name");
+  static constexpr size_t TIME_STARTED = job_column<Model>("time_started");
+  static constexpr size_t MEDIA = job_kind<Model>(MEDIA_NAME);
+  static constexpr size_t TYPE = job_kind<Model>(MEDIA_TYPE);
+  static constexpr size_t UNITS = job_kind<Model>(MEDIA_UNITS);
+  static_assert(JOB_ID < JOBS && JOB_NAME < JOBS && TIME_STARTED < JOBS,
+      "a model needs job_id, job_name and time_started fields");
+  static_assert(MEDIA < JOBS && TYPE < JOBS && UNITS < JOBS,
+      "a model needs media name, type and units fields");
+
+  std::string text[JOBS];
+  int ref[JOBS];
+  std::string ink[INKS];
+  // where in the log the block ends
+  log_position end;
+};
+
+// returns the text of the i'th job value of r
+template <class Model>
+const std::string& job_value(const job_record<Model>& r, size_t i) {
+  return Model::job[i].kind == TEXT ? r.text[i] : lookup(r.ref[i]);
+}
+
+// returns a rough estimate of the memory used by a job_record
+template <class Model>
+size_t record_bytes(const job_record<Model>& r) {
+  size_t bytes = sizeof(r);
+  for (size_t i = 0; i < job_record<Model>::JOBS; i++) {
+    bytes += r.text[i].capacity();
+  }
+  for (size_t i = 0; i < job_record<Model>::INKS; i++) {
+    bytes += r.ink[i].capacity();
+  }
+  return bytes + r.end.segment.capacity();
+}
+
+//#####################
+// TOKENIZER
+//#####################
+
+// returns the value of the i'th job field of line without parsing the rest,
+// which is all the parser needs to decide whether it wants the block at all
+template <class Model, size_t I>
+std::string peek_job_value(const std::string& line) {
+  constexpr size_t label_length = length(Model::job[I].label);
+  size_t start = line.find(Model::job[I].label);
+  if (start == std::string::npos) {
+    return "";
+  }
+  start += label_length;
+  if constexpr (I + 1 == std::size(Model::job)) {
+    return line.substr(start);
+  } else {
+    size_t end = line.find(Model::job[I + 1].label, start);
+    // -1 for the space in front of the next label
+    return end == std::string::npos ? "" : line.substr(start, end - start - 1);
+  }
+}
+
+// splits the job line into r. every label is looked for after the
+// previous value, so a label that is also the tail of another one
+// ("Type: " in "Media Type: ") can never be matched in the wrong place.
+// returns false if a label is missing, i.e. line is not from a Model
+template <class Model>
+bool parse_job_line(const std::string& line, job_record<Model>& r) {
+  constexpr size_t N = std::size(Model::job);
+  size_t start[N];
+  size_t end[N];
+  size_t pos = 0;
+  for (size_t i = 0; i < N; i++) {
+    size_t at = line.find(Model::job[i].label, pos);
+    if (at == std::string::npos) {
+      std::cerr << "parse_job_line(): no <" << Model::job[i].label << "> in job line for model <"
+                << Model::name << "> - skipping block" << std::endl;
+      return false;
+    }
+    // the previous value ends at the space in front of this label
+    if (i > 0) {
+      end[i - 1] = at > start[i - 1] ? at - 1 : at;
+    }
+    start[i] = at + length(Model::job[i].label);
+    pos = start[i];
+  }
+  end[N - 1] = line.size();
+  for (size_t i = 0; i < N; i++) {
+    if (Model::job[i].kind == TEXT) {
+      r.text[i].assign(line, start[i], end[i] - start[i]);
+    } else {
+      r.ref[i] = intern(line.substr(start[i], end[i] - start[i]));
+    }
+  }
+  return true;
+}
+
+// what came of reading the rest of a block
+enum parse_result {
+  PARSED,      // all there and as Model expects
+  MISMATCH,    // not a block from a Model printer, reported
+  INCOMPLETE   // the log ends part way, the printer is still writing it
+};
+
+// reads the "Total Ink Usage:" line and the ink lines after it into r,
+// checking every line is for the ink Model expects in that place.
+// a line without its '\n' yet could still grow, so it is never parsed.
+// a line that does not fit is handed back, it may start the next block
+template <class Model>
+parse_result parse_ink_lines(log_reader& reader, job_record<Model>& r) {
+  const char total[] = "Total Ink Usage:";
+  const char ink_name[] = "Ink Name: ";
+  const char consumption[] = " Ink Consumption: ";
+  const char units[] = " Ink Units: ";
+  std::string line;
+  if (!read_complete_line(reader, line)) {
+    return INCOMPLETE;
+  }
+  if (line.find(total) == std::string::npos) {
+    std::cerr << "parse_ink_lines(): no <" << total << "> after job line - skipping block" << std::endl;
+    unread_line(reader, line);
+    return MISMATCH;
+  }
+  for (size_t i = 0; i < job_record<Model>::INKS; i++) {
+    if (!read_complete_line(reader, line)) {
+      return INCOMPLETE;
+    }
+    // the line has to be "Ink Name: <name> Ink Consumption: ..."
+    size_t at = line.find(ink_name);
+    const char* name = Model::inks[i].name;
+    bool ok = at != std::string::npos;
+    if (ok) {
+      at += length(ink_name);
+      ok = line.compare(at, length(name), name) == 0 &&
+           line.compare(at + length(name), length(consumption), consumption) == 0;
+    }
+    if (!ok) {
+      std::cerr << "parse_ink_lines(): expected ink <" << name << "> for model <" << Model::name
+                << "> but got <" << line << "> - skipping block" << std::endl;
+      unread_line(reader, line);
+      return MISMATCH;
+    }
+    at += length(name) + length(consumption);
+    size_t end = line.find(units, at);
+    r.ink[i].assign(line, at, end == std::string::npos ? std::string::npos : end - at);
+  }
+  // one more ink line means the printer has more inks than Model.
+  // if that line is only part written we cannot tell yet
+  log_position before = log_at(reader);
+  if (read_line(reader, line)) {
+    bool complete = !same_position(before, log_at(reader));
+    if (complete && line.find(ink_name) != std::string::npos) {
+      std::cerr << "parse_ink_lines(): unexpected ink <" << line << "> for model <" << Model::name
+                << "> - skipping block" << std::endl;
+      return MISMATCH;
+    }
+    unread_line(reader, line);
+    if (!complete) {
+      return INCOMPLETE;
+    }
+  }
+  return PARSED;
+}
+
+//#####################
+// SQL
+//#####################
+
+// columns of Model::table an insert fills in, in order
+template <class Model>
+const std::string& insert_columns() {
+  static std::string columns;
+  if (columns.empty()) {
+    columns = "printer_id";
+    for (size_t i = 0; i < std::size(Model::job); i++) {
+      if (Model::job[i].kind == MEDIA_NAME) {
+        columns += ", media_id";
+      } else if (Model::job[i].kind != MEDIA_TYPE && Model::job[i].kind != MEDIA_UNITS) {
+        columns += std::string(", ") + Model::job[i].column;
+      }
+    }
+    for (size_t i = 0; i < std::size(Model::inks); i++) {
+      columns += std::string(", ") + Model::inks[i].column;
+    }
+  }
+  return columns;
+}
+
+// sql that creates Model::table and the index the job cache uses.
+// the printer and media are stored as ids into their lookup tables,
+// everything else is stored as text because it is coming to us as
+// text, and we do not need to do any operations on the values
+template <class Model>
+std::string create_table_sql() {
+  std::string table = Model::table;
+  std::string sql = "CREATE TABLE IF NOT EXISTS " + table + "(" \
+        "id integer NOT NULL PRIMARY KEY AUTOINCREMENT," \
+        "printer_id integer NOT NULL REFERENCES printer(id)";
+  for (size_t i = 0; i < std::size(Model::job); i++) {
+    if (Model::job[i].kind == MEDIA_NAME) {
+      sql += ", media_id integer NOT NULL REFERENCES media(id)";
+    } else if (Model::job[i].kind != MEDIA_TYPE && Model::job[i].kind != MEDIA_UNITS) {
+      sql += std::string(", ") + Model::job[i].column + " text NOT NULL";
+    }
+  }
+  for (size_t i = 0; i < std::size(Model::inks); i++) {
+    sql += std::string(", ") + Model::inks[i].column + " text NOT NULL";
+  }
+  sql += ");CREATE INDEX IF NOT EXISTS " + table + "_recent ON " + table + "(printer_id, time_started, job_id);";
+  return sql;
+}
+
+// the flat layout of Model::view, as a select list over the
+// table (j) joined with the printer (p) and media (m) tables
+template <class Model>
+std::string flat_columns() {
+  std::string sql = "j.id, p.name AS printer_name";
+  for (size_t i = 0; i < std::size(Model::job); i++) {
+    std::string column = Model::job[i].column;
+    switch (Model::job[i].kind) {
+      case MEDIA_NAME:  sql += ", m.name AS " + column; break;
+      case MEDIA_TYPE:  sql += ", m.type AS " + column; break;
+      case MEDIA_UNITS: sql += ", m.units AS " + column; break;
+      default:          sql += ", j." + column; break;
+    }
+  }
+  for (size_t i = 0; i < std::size(Model::inks); i++) {
+    sql += std::string(", j.") + Model::inks[i].column;
+  }
+  return sql;
+}
+
+// sql that creates Model::view, which keeps the old flat layout
+// around so existing reports and queries keep working unchanged
+template <class Model>
+std::string create_view_sql() {
+  return std::string("CREATE VIEW IF NOT EXISTS ") + Model::view + " AS SELECT " + flat_columns<Model>() +
+         " FROM " + Model::table + " j" +
+         " JOIN printer p ON p.id = j.printer_id" +
+         " JOIN media m ON m.id = j.media_id;";
+}
+
+// sql that moves the rows of an old flat table named Model::view
+// into Model::table and drops it, so the view can take its name.
+// rows keep their ids, anything that stored one still finds its job,
+// and so does the autoincrement counter, so no old id is handed out again
+template <class Model>
+std::string migrate_sql() {
+  typedef job_record<Model> record;
+  std::string flat = Model::view;
+  std::string media = Model::job[record::MEDIA].column;
+  std::string type = Model::job[record::TYPE].column;
+  std::string units = Model::job[record::UNITS].column;
+  std::string select = "j.id, p.id";
+  for (size_t i = 0; i < std::size(Model::job); i++) {
+    if (Model::job[i].kind == MEDIA_NAME) {
+      select += ", m.id";
+    } else if (Model::job[i].kind != MEDIA_TYPE && Model::job[i].kind != MEDIA_UNITS) {
+      select += std::string(", j.") + Model::job[i].column;
+    }
+  }
+  for (size_t i = 0; i < std::size(Model::inks); i++) {
+    select += std::string(", j.") + Model::inks[i].column;
+  }
+  return "BEGIN;" \
+         "INSERT OR IGNORE INTO printer (name) SELECT DISTINCT printer_name FROM " + flat + ";" \
+         "INSERT OR IGNORE INTO media (name, type, units) " \
+         "SELECT DISTINCT " + media + ", " + type + ", " + units + " FROM " + flat + ";" \
+         "INSERT INTO " + Model::table + " (id, " + insert_columns<Model>() + ") " \
+         "SELECT " + select + " FROM " + flat + " j " \
+         "JOIN printer p ON p.name = j.printer_name " \
+         "JOIN media m ON m.name = j." + media + " AND m.type = j." + type + " AND m.units = j." + units + " " \
+         "ORDER BY j.id;" \
+         "DELETE FROM sqlite_sequence WHERE name = '" + Model::table + "' " \
+         "AND seq <= (SELECT seq FROM sqlite_sequence WHERE name = '" + flat + "');" \
+         "UPDATE sqlite_sequence SET name = '" + Model::table + "' WHERE name = '" + flat + "' " \
+         "AND NOT EXISTS (SELECT 1 FROM sqlite_sequence WHERE name = '" + Model::table + "');" \
+         "DROP TABLE " + flat + ";" \
+         "COMMIT;";
+}
+
+// sql that inserts a row into Model::table, with a ? per column
+template <class Model>
+const std::string& insert_sql() {
+  static std::string sql;
+  if (sql.empty()) {
+    const std::string& columns = insert_columns<Model>();
+    sql = std::string("INSERT INTO ") + Model::table + " (" + columns + ") VALUES (?";
+    for (size_t i = 0; i < columns.size(); i++) {
+      if (columns[i] == ',') {
+        sql += ",?";
+      }
+    }
+    sql += ");";
+  }
+  return sql;
+}
+
+// the values that go in the ?s of insert_sql() to insert r
+template <class Model>
+std::vector<std::string> insert_values(const job_record<Model>& r, int printer_id, int media_id) {
+  std::vector<std::string> values;
+  values.push_back(std::to_string(printer_id));
+  for (size_t i = 0; i < std::size(Model::job); i++) {
+    if (Model::job[i].kind == MEDIA_NAME) {
+      values.push_back(std::to_string(media_id));
+    } else if (Model::job[i].kind != MEDIA_TYPE && Model::job[i].kind != MEDIA_UNITS) {
+      values.push_back(job_value(r, i));
+    }
+  }
+  for (size_t i = 0; i < std::size(Model::inks); i++) {
+    values.push_back(r.ink[i]);
+  }
+  return values;
+}
@@ -0,0 +1,83 @@
+/*
+ * These are the statements everything that comes out of the log is
+ * written and looked up with. Values are never pasted into the sql
+ * text, they are bound to the statement's ?s, so a job named
+ * "Bob's_Fish.rtl" goes in as it is instead of breaking the sql.
+ *
+ * Each distinct sql text is prepared once per connection and kept
+ * around, the job inserts are the same statement every time.
+ *
+ * Values are bound as text, integer columns (ids, offsets) convert
+ * them through their column affinity.
+ *
+ */
+
+#pragma once
+
+/* Inclusions */
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+#include <functional>
+#include <iostream>
+#include <sqlite3.h>
+
+// how long a connection waits for another one (another printer's
+// ingest, a report) to let go of the db before giving up
+const int BUSY_TIMEOUT_MS = 5000;
+
+// sql text with ?s, and the values that go in them, in order
+struct sql_statement {
+  std::string sql;
+  std::vector<std::string> values;
+};
+
+// prepared statements by connection and sql text
+std::map<std::pair<sqlite3*, std::string>, sqlite3_stmt*> STATEMENTS;
+
+// returns the prepared statement for sql on db, or NULL if it
+// cannot be prepared (the reason is left in sqlite3_errmsg(db))
+sqlite3_stmt* prepare_statement(sqlite3* db, const std::string& sql) {
+  auto key = std::make_pair(db, sql);
+  auto it = STATEMENTS.find(key);
+  if (it != STATEMENTS.end()) {
+    return it->second;
+  }
+  sqlite3_stmt* stmt = NULL;
+  if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, NULL) != SQLITE_OK) {
+    sqlite3_finalize(stmt);
+    return NULL;
+  }
+  STATEMENTS.insert({key, stmt});
+  return stmt;
+}
+
+// runs s on db, calling row for every row it returns. returns false
+// if it failed, the reason is left in sqlite3_errmsg(db)
+bool run_statement(sqlite3* db, const sql_statement& s,
+                   const std::function<void(sqlite3_stmt*)>& row = nullptr) {
+  sqlite3_stmt* stmt = prepare_statement(db, s.sql);
+  if (stmt == NULL) {
+    return false;
+  }
+  for (unsigned int i = 0; i < s.values.size(); i++) {
+    sqlite3_bind_text(stmt, i + 1, s.values[i].data(), s.values[i].size(), SQLITE_STATIC);
+  }
+  int rc;
+  while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    if (row) {
+      row(stmt);
+    }
+  }
+  // the values are only borrowed, let go of them before s does
+  sqlite3_reset(stmt);
+  sqlite3_clear_bindings(stmt);
+  return rc == SQLITE_DONE;
+}
+
+// returns column i of the current row of stmt as text, "" for NULL
+std::string column_text(sqlite3_stmt* stmt, int i) {
+  const unsigned char* text = sqlite3_column_text(stmt, i);
+  return text == NULL ? "" : reinterpret_cast<const char*>(text);
+}
@@ -0,0 +1,42 @@
+/*
+ * This is a simple string interning table used by the parser
+ * to store repeated low cardinality values (printer names,
+ * media names, units...) exactly once in memory. Each distinct
+ * string is given a small integer id the first time it is seen
+ * and every later occurrence just reuses that id.
+ *
+ */
+
+#pragma once
+
+/* Inclusions */
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+// the interning table itself, ids are indexes into strs
+struct string_table {
+  std::unordered_map<std::string, int> ids;
+  std::vector<std::string> strs;
+};
+
+// global table shared by everything in the parser
+string_table STRINGS;
+
+// returns the id of s, adding it to the table if need be
+int intern(const std::string& s, string_table& table = STRINGS) {
+  auto it = table.ids.find(s);
+  if (it != table.ids.end()) {
+    return it->second;
+  }
+  // first time we have seen this string
+  int id = table.strs.size();
+  table.strs.push_back(s);
+  table.ids.insert({s, id});
+  return id;
+}
+
+// returns the string stored for id
+const std::string& lookup(int id, const string_table& table = STRINGS) {
+  return table.strs[id];
+}